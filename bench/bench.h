@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Helpers shared by the benchmarks, `make bench` builds and runs them */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Monotonic time in seconds */
+static inline double bench_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The simulator dumps memory and page tables on stdout. bench_quiet()
+ * sends them to /dev/null until bench_loud(), so that only the
+ * measured numbers are printed */
+static int bench_stdout = -1;
+
+static inline void bench_quiet(void) {
+	int fd;
+
+	fflush(stdout);
+	bench_stdout = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+}
+
+static inline void bench_loud(void) {
+	fflush(stdout);
+	dup2(bench_stdout, STDOUT_FILENO);
+	close(bench_stdout);
+	bench_stdout = -1;
+}
+
+#endif
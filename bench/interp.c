@@ -0,0 +1,128 @@
+/*
+ * interp - instructions per second of the CPU interpreter, one
+ * instruction per run() call as the CPU loop used to do against a
+ * whole time slice per run_slice() call, for a CALC-heavy and a
+ * memory-heavy program. The memory instructions go through the
+ * configured backend, dumps included (sent to /dev/null).
+ *
+ * Usage: interp [CALC program size]
+ */
+
+#include "bench.h"
+#include "cpu.h"
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERP_CALC_SZ 10000000
+#define INTERP_MEM_SZ 20000
+#define INTERP_RG_SZ 512
+/* Small RAM, IODUMP dumps all of it at every memory instruction */
+#define INTERP_RAM_SZ 0x800
+#define INTERP_SWP_SZ 0x10000
+
+/* Time slices of the sample configurations */
+static uint32_t slices[] = { 2, 6 };
+
+static struct memphy_struct mram, mswp, tlb;
+static struct memphy_struct * swp[1] = { &mswp };
+static int next_pid = 1;
+
+static struct code_seg_t * interp_program(uint32_t size, int mem) {
+	struct code_seg_t * code = calloc(1, sizeof(struct code_seg_t));
+	uint32_t i;
+
+	code->size = size;
+	code->text = calloc(size, sizeof(struct inst_t));
+	for (i = 0; i < size; i++) {
+		struct inst_t * ins = &code->text[i];
+
+		if (!mem) {
+			ins->opcode = CALC;
+		}else if (i == 0) {
+			/* alloc INTERP_RG_SZ 0 */
+			ins->opcode = ALLOC;
+			ins->arg_0 = INTERP_RG_SZ;
+		}else if (i & 1) {
+			/* write data 0 offset */
+			ins->opcode = WRITE;
+			ins->arg_0 = i & 0xff;
+			ins->arg_2 = (i * 7) % INTERP_RG_SZ;
+		}else{
+			/* read 0 offset 1 */
+			ins->opcode = READ;
+			ins->arg_1 = (i * 7) % INTERP_RG_SZ;
+			ins->arg_2 = 1;
+		}
+	}
+	decode(code);
+	return code;
+}
+
+/* Run the program once in a new process, [slice] 0 for run() */
+static double interp_run(struct code_seg_t * code, uint32_t slice) {
+	struct pcb_t proc;
+	double t0, t1;
+
+	memset(&proc, 0, sizeof(proc));
+	proc.pid = next_pid++;
+	proc.code = code;
+	proc.mm = malloc(sizeof(struct mm_struct));
+	init_mm(proc.mm, &proc);
+	proc.mram = &mram;
+	proc.mswp = swp;
+	proc.active_mswp = &mswp;
+#ifdef CPU_TLB
+	proc.tlb = &tlb;
+#endif
+
+	bench_quiet();
+	t0 = bench_now();
+	if (slice == 0) {
+		while (proc.pc < code->size) {
+			run(&proc);
+		}
+	}else{
+		while (proc.pc < code->size) {
+			run_slice(&proc, slice);
+		}
+	}
+	t1 = bench_now();
+	bench_loud();
+
+	free_pcb_memph(&proc);
+	return code->size / (t1 - t0);
+}
+
+static void interp_bench(const char * name, struct code_seg_t * code) {
+	int i;
+
+	printf("  %-4s %8u inst  run           %12.0f inst/s\n", name,
+		code->size, interp_run(code, 0));
+	for (i = 0; i < sizeof(slices) / sizeof(slices[0]); i++) {
+		printf("  %-4s %8u inst  run_slice(%u)  %12.0f inst/s\n", name,
+			code->size, slices[i], interp_run(code, slices[i]));
+	}
+}
+
+int main(int argc, char * argv[]) {
+	uint32_t calc_sz = argc > 1 ? atol(argv[1]) : INTERP_CALC_SZ;
+
+	init_memphy(&mram, INTERP_RAM_SZ, 1);
+	init_memphy(&mswp, INTERP_SWP_SZ, 1);
+	init_tlbmemphy(&tlb, CPUTLB_DEFAULT_SZ, CPUTLB_DEFAULT_WAYS);
+
+	struct code_seg_t * calc = interp_program(calc_sz, 0);
+	struct code_seg_t * mem = interp_program(INTERP_MEM_SZ, 1);
+
+	printf("interp: decoded programs in new processes\n");
+	interp_bench("calc", calc);
+	interp_bench("mem", mem);
+	free(calc->text);
+	free(calc->dtext);
+	free(calc);
+	free(mem->text);
+	free(mem->dtext);
+	free(mem);
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * mm_scale - memory operations of independent processes across CPUs.
+ * Each CPU thread runs its own process, which reads and writes random
+ * pages of a working set 1.5x its share of the shared RAM, under its
+ * own mm lock as __read/__write do. Page faults meet on the shared
+ * RAM and swap frame pools only.
+ *
+ * Usage: mm_scale [operations per CPU]
+ */
+
+#include "bench.h"
+#include "mm.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCALE_OPS 400000
+/* RAM frames per CPU, working set pages per process in regions */
+#define SCALE_FRAMES 64
+#define SCALE_RG_PAGES 32
+#define SCALE_NR_RG 3
+
+static int cpus_tested[] = { 1, 2, 4, 8 };
+
+struct scale_arg {
+	struct pcb_t proc;
+	long ops;
+	int addr;
+	int failed;
+};
+
+static int go;
+
+static void * cpu_routine(void * arg) {
+	struct scale_arg * sa = (struct scale_arg *)arg;
+	struct mm_struct * mm = sa->proc.mm;
+	unsigned int seed = sa->proc.pid;
+	int pages = SCALE_NR_RG * SCALE_RG_PAGES;
+	BYTE data;
+	long i;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+	for (i = 0; i < sa->ops; i++) {
+		int addr;
+
+		seed = seed * 1103515245 + 12345;
+		addr = sa->addr + (seed >> 8) % (pages * PAGING_PAGESZ);
+		pthread_mutex_lock(&mm->lock);
+		if (i & 1) {
+			sa->failed |= pg_getval(mm, addr, &data, &sa->proc) < 0;
+		}else{
+			sa->failed |= pg_setval(mm, addr, (BYTE)i, &sa->proc) < 0;
+		}
+		pthread_mutex_unlock(&mm->lock);
+	}
+	return NULL;
+}
+
+static void scale_run(int cpus, long ops) {
+	struct memphy_struct mram, mswp;
+	struct memphy_struct * swp[1] = { &mswp };
+	struct scale_arg * sa = calloc(cpus, sizeof(struct scale_arg));
+	pthread_t * cpu = malloc(cpus * sizeof(pthread_t));
+	double t0, t1;
+	int i, rgid, rgaddr;
+
+	init_memphy(&mram, cpus * SCALE_FRAMES * PAGING_PAGESZ, 1);
+	init_memphy(&mswp, cpus * SCALE_NR_RG * SCALE_RG_PAGES * PAGING_PAGESZ, 1);
+	for (i = 0; i < cpus; i++) {
+		sa[i].proc.pid = i + 1;
+		sa[i].proc.mm = malloc(sizeof(struct mm_struct));
+		init_mm(sa[i].proc.mm, &sa[i].proc);
+		sa[i].proc.mram = &mram;
+		sa[i].proc.mswp = swp;
+		sa[i].proc.active_mswp = &mswp;
+		sa[i].ops = ops;
+	}
+
+	/* Region by region so that every process has its share of RAM
+	 * before evicting its own pages. __alloc dumps the page table */
+	bench_quiet();
+	for (rgid = 0; rgid < SCALE_NR_RG; rgid++) {
+		for (i = 0; i < cpus; i++) {
+			if (__alloc(&sa[i].proc, 0, rgid, SCALE_RG_PAGES * PAGING_PAGESZ,
+					rgid ? &rgaddr : &sa[i].addr) < 0) {
+				bench_loud();
+				printf("  %d CPUs: cannot allocate region %d\n", cpus, rgid);
+				exit(1);
+			}
+		}
+	}
+	bench_loud();
+
+	go = 0;
+	for (i = 0; i < cpus; i++) {
+		pthread_create(&cpu[i], NULL, cpu_routine, &sa[i]);
+	}
+	t0 = bench_now();
+	__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < cpus; i++) {
+		pthread_join(cpu[i], NULL);
+	}
+	t1 = bench_now();
+
+	printf("  %d CPUs %12.0f ops/s %12.0f ops/s per CPU\n", cpus,
+		cpus * ops / (t1 - t0), ops / (t1 - t0));
+	for (i = 0; i < cpus; i++) {
+		if (sa[i].failed) {
+			printf("  %d CPUs: memory access of process %d failed\n",
+				cpus, sa[i].proc.pid);
+			exit(1);
+		}
+		free_pcb_memph(&sa[i].proc);
+	}
+
+	free(mram.storage);
+	free(mswp.storage);
+	free(mram.free_fp_stack);
+	free(mswp.free_fp_stack);
+	free(mram.fp_tbl);
+	free(mswp.fp_tbl);
+	free(cpu);
+	free(sa);
+}
+
+int main(int argc, char * argv[]) {
+	long ops = argc > 1 ? atol(argv[1]) : SCALE_OPS;
+	int t;
+
+	printf("mm_scale: %ld random reads/writes per CPU, %d pages per "
+		"process, %d RAM frames per CPU\n", ops,
+		SCALE_NR_RG * SCALE_RG_PAGES, SCALE_FRAMES);
+	for (t = 0; t < sizeof(cpus_tested) / sizeof(cpus_tested[0]); t++) {
+		scale_run(cpus_tested[t], ops);
+	}
+	return 0;
+}
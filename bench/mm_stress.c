@@ -0,0 +1,153 @@
+/*
+ * mm_stress - data integrity of memory operations under contention.
+ * CPU threads run their own process on a RAM much smaller than their
+ * working sets, each randomly writing and reading back its regions
+ * with __write/__read against a shadow copy; with CPU_TLB the writes
+ * go through the CPU's tlbwrite and a TLB per CPU instead. Every
+ * access must succeed and every read must return the last value
+ * written. Built
+ * with the configured reclaim (mm_stress) and with MM_GLOBAL_RECLAIM
+ * (mm_stress_global).
+ *
+ * Usage: mm_stress[_global] [operations per CPU]
+ */
+
+#include "bench.h"
+#include "mm.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_OPS 20000
+#define STRESS_CPUS 4
+#define STRESS_FRAMES 12
+/* Regions of each process, of STRESS_RG_PAGES pages */
+#define STRESS_NR_RG 4
+#define STRESS_RG_PAGES 2
+#define STRESS_RG_SZ (STRESS_RG_PAGES * PAGING_PAGESZ)
+
+#ifdef MM_GLOBAL_RECLAIM
+#define STRESS_NAME "global reclaim"
+#else
+#define STRESS_NAME "per process FIFO"
+#endif
+
+struct stress_arg {
+	struct pcb_t proc;
+	long ops;
+	BYTE shadow[STRESS_NR_RG][STRESS_RG_SZ];
+	long failed;
+	long wrong;
+};
+
+static int go;
+
+static void * cpu_routine(void * arg) {
+	struct stress_arg * sa = (struct stress_arg *)arg;
+	unsigned int seed = sa->proc.pid;
+	BYTE data;
+	long i;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+	for (i = 0; i < sa->ops; i++) {
+		int rgid, offset;
+
+		seed = seed * 1103515245 + 12345;
+		rgid = (seed >> 8) % STRESS_NR_RG;
+		offset = (seed >> 12) % STRESS_RG_SZ;
+		if (seed & 0x10000) {
+			data = (BYTE)(seed >> 20);
+#ifdef CPU_TLB
+			if (tlbwrite(&sa->proc, data, rgid, offset) == 0) {
+#else
+			if (__write(&sa->proc, 0, rgid, offset, data) == 0) {
+#endif
+				sa->shadow[rgid][offset] = data;
+			}else{
+				sa->failed++;
+			}
+		}else if (__read(&sa->proc, 0, rgid, offset, &data) != 0) {
+			sa->failed++;
+		}else if (data != sa->shadow[rgid][offset]) {
+			sa->wrong++;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+	long ops = argc > 1 ? atol(argv[1]) : STRESS_OPS;
+	struct memphy_struct mram, mswp;
+	struct memphy_struct * swp[1] = { &mswp };
+#ifdef CPU_TLB
+	struct memphy_struct tlb[STRESS_CPUS];
+#endif
+	struct stress_arg * sa = calloc(STRESS_CPUS, sizeof(struct stress_arg));
+	pthread_t cpu[STRESS_CPUS];
+	long failed = 0, wrong = 0;
+	int i, rgid, addr, offset;
+	double t0, t1;
+
+	init_memphy(&mram, STRESS_FRAMES * PAGING_PAGESZ, 1);
+	init_memphy(&mswp, STRESS_CPUS * STRESS_NR_RG * STRESS_RG_SZ, 1);
+	for (i = 0; i < STRESS_CPUS; i++) {
+		sa[i].proc.pid = i + 1;
+		sa[i].proc.mm = malloc(sizeof(struct mm_struct));
+		init_mm(sa[i].proc.mm, &sa[i].proc);
+		sa[i].proc.mram = &mram;
+		sa[i].proc.mswp = swp;
+		sa[i].proc.active_mswp = &mswp;
+#ifdef CPU_TLB
+		init_tlbmemphy(&tlb[i], CPUTLB_DEFAULT_SZ, CPUTLB_DEFAULT_WAYS);
+		sa[i].proc.tlb = &tlb[i];
+#endif
+		sa[i].ops = ops;
+	}
+
+	/* Region by region so that every process has frames of its own to
+	 * evict. __alloc dumps the page table */
+	bench_quiet();
+	for (rgid = 0; rgid < STRESS_NR_RG; rgid++) {
+		for (i = 0; i < STRESS_CPUS; i++) {
+			if (__alloc(&sa[i].proc, 0, rgid, STRESS_RG_SZ, &addr) < 0) {
+				bench_loud();
+				printf("mm_stress: cannot allocate region %d of process %d\n",
+					rgid, sa[i].proc.pid);
+				return 1;
+			}
+			/* Regions start zeroed in the shadow */
+			for (offset = 0; offset < STRESS_RG_SZ; offset++) {
+				__write(&sa[i].proc, 0, rgid, offset, 0);
+			}
+		}
+	}
+	bench_loud();
+
+	/* tlbwrite dumps the TLB and the RAM */
+	go = 0;
+	for (i = 0; i < STRESS_CPUS; i++) {
+		pthread_create(&cpu[i], NULL, cpu_routine, &sa[i]);
+	}
+	bench_quiet();
+	t0 = bench_now();
+	__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < STRESS_CPUS; i++) {
+		pthread_join(cpu[i], NULL);
+		failed += sa[i].failed;
+		wrong += sa[i].wrong;
+	}
+	t1 = bench_now();
+	bench_loud();
+
+	printf("mm_stress: %s, %d CPUs, %d RAM frames, %d pages per process\n",
+		STRESS_NAME, STRESS_CPUS, STRESS_FRAMES, STRESS_NR_RG * STRESS_RG_PAGES);
+	printf("  %12.0f ops/s %8ld failed accesses %8ld wrong reads\n",
+		STRESS_CPUS * ops / (t1 - t0), failed, wrong);
+
+	for (i = 0; i < STRESS_CPUS; i++) {
+		free_pcb_memph(&sa[i].proc);
+	}
+	free(sa);
+	return failed != 0 || wrong != 0;
+}
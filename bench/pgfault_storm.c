@@ -0,0 +1,135 @@
+/*
+ * pgfault_storm - page fault throughput against the resident set size.
+ * A process touches twice as many pages as fit in RAM in a cycle, so
+ * that every touch faults, swaps a victim out and the page back in.
+ * With an O(1) victim queue the faults/s stay flat as RAM grows.
+ *
+ * Built with MM_KSWAPD (pgfault_storm_kswapd), 3 touches of 4 cycle
+ * through a hot set of half the RAM and the others stream through the
+ * rest of the pages, kswapd runs between the touches. Only the stream
+ * should fault, a kswapd evicting hot pages adds faults on the hot set.
+ *
+ * Usage: pgfault_storm [touches per run]
+ */
+
+#include "bench.h"
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STORM_TOUCHES 400000
+#ifdef MM_KSWAPD
+/* Touches between two kswapd passes */
+#define STORM_KSWAPD_PERIOD 8
+#endif
+
+static int ram_frames[] = { 64, 256, 1024, 4096 };
+
+/* Page of the i-th touch */
+static int storm_page(long i, int pages) {
+#ifdef MM_KSWAPD
+	int hot = pages / 4;
+
+	if (i % 4 != 3) {
+		return (i / 4 * 3 + i % 4) % hot;
+	}
+	return hot + (i / 4) % (pages - hot);
+#else
+	return i % pages;
+#endif
+}
+
+static void storm_run(int frames, long touches) {
+	struct memphy_struct mram, mswp;
+	struct memphy_struct * swp[1] = { &mswp };
+	struct pcb_t proc;
+	int pages = 2 * frames;
+	long i, faults = 0;
+#ifdef MM_KSWAPD
+	long bg = 0;
+#endif
+	double t0, t1;
+	int addr, rgaddr, rgid;
+
+	init_memphy(&mram, frames * PAGING_PAGESZ, 1);
+	init_memphy(&mswp, 2 * pages * PAGING_PAGESZ, 1);
+	memset(&proc, 0, sizeof(proc));
+	proc.pid = 1;
+	proc.mm = malloc(sizeof(struct mm_struct));
+	init_mm(proc.mm, &proc);
+	proc.mram = &mram;
+	proc.mswp = swp;
+	proc.active_mswp = &mswp;
+
+	/* Regions of half the RAM, a mapping cannot evict its own pages;
+	 * they are contiguous from the break. __alloc dumps the page table */
+	bench_quiet();
+	for (rgid = 0; rgid < 4; rgid++) {
+		if (__alloc(&proc, 0, rgid, pages / 4 * PAGING_PAGESZ,
+				rgid ? &rgaddr : &addr) < 0) {
+			bench_loud();
+			printf("  %5d frames: cannot allocate %d pages\n", frames, pages);
+			exit(1);
+		}
+	}
+	bench_loud();
+
+	pthread_mutex_lock(&proc.mm->lock);
+	t0 = bench_now();
+	for (i = 0; i < touches; i++) {
+		int pgaddr = addr + storm_page(i, pages) * PAGING_PAGESZ;
+
+		faults += PAGING_PAGE_SWAPPED(pte_get(proc.mm, PAGING_PGN(pgaddr))) != 0;
+		if (pg_setval(proc.mm, pgaddr, (BYTE)i, &proc) < 0) {
+			printf("  %5d frames: touch of %08x failed\n", frames, pgaddr);
+			exit(1);
+		}
+#ifdef MM_KSWAPD
+		if (i % STORM_KSWAPD_PERIOD == STORM_KSWAPD_PERIOD - 1) {
+			/* It only trylocks the owners */
+			pthread_mutex_unlock(&proc.mm->lock);
+			bg += kswapd_reclaim(&mram, &mswp);
+			pthread_mutex_lock(&proc.mm->lock);
+		}
+#endif
+	}
+	t1 = bench_now();
+	pthread_mutex_unlock(&proc.mm->lock);
+
+	printf("  %5d frames %5d pages %12.0f faults/s %6.1f%% of touches",
+		frames, pages, faults / (t1 - t0), 100.0 * faults / touches);
+#ifdef MM_KSWAPD
+	printf(" %8ld faults %8ld by kswapd", faults, bg);
+#endif
+	printf("\n");
+
+	free_pcb_memph(&proc);
+	free(mram.storage);
+	free(mswp.storage);
+	free(mram.free_fp_stack);
+	free(mswp.free_fp_stack);
+	free(mram.fp_tbl);
+	free(mswp.fp_tbl);
+}
+
+int main(int argc, char * argv[]) {
+	long touches = argc > 1 ? atol(argv[1]) : STORM_TOUCHES;
+	int i, p;
+
+#ifdef MM_KSWAPD
+	/* The victims come from the global lists, no policy to select */
+	for (p = 0; p < 1; p++) {
+		printf("pgfault_storm: global with kswapd, %ld touches of a hot"
+			" set and a stream\n", touches);
+#else
+	for (p = 0; p < 2; p++) {
+		pgrep_select(p ? "clock" : "fifo");
+		printf("pgfault_storm: %s, %ld cyclic touches of 2x RAM\n",
+			pgrep->name, touches);
+#endif
+		for (i = 0; i < sizeof(ram_frames) / sizeof(ram_frames[0]); i++) {
+			storm_run(ram_frames[i], touches);
+		}
+	}
+	return 0;
+}
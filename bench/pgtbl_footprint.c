@@ -0,0 +1,102 @@
+/*
+ * pgtbl_footprint - page table memory of many processes, two-level
+ * radix table against the flat PAGING_MAX_PGN entries table it
+ * replaced, and the cost of tearing them down.
+ *
+ * Usage: pgtbl_footprint [processes]
+ */
+
+#include "bench.h"
+#include "mm.h"
+#include <stdlib.h>
+
+#define FOOT_PROCS 4096
+
+struct foot_pattern {
+	const char * name;
+	int nr_pages;	/* pages mapped */
+	int stride;	/* between two mapped pages */
+};
+
+static struct foot_pattern patterns[] = {
+	{ "small",    16,   1 },	/* the sample programs */
+	{ "dense",  4096,   1 },
+	{ "sparse",   64, 256 },
+};
+
+static int count_pte(struct mm_struct * mm, int pgn, uint32_t * pte, void * arg) {
+	*(long *)arg += PAGING_PAGE_PRESENT(*pte) != 0;
+	return 0;
+}
+
+static void foot_run(struct foot_pattern * pat, int nr_procs) {
+	struct mm_struct * mm = calloc(nr_procs, sizeof(struct mm_struct));
+	uint32_t ** flat = malloc(nr_procs * sizeof(uint32_t *));
+	struct pcb_t proc;
+	long leaves = 0, mapped = 0, flat_mapped = 0;
+	double radix_kb, flat_kb, t0, t1, t2;
+	int i, p, pgn, dir;
+
+	for (i = 0; i < nr_procs; i++) {
+		proc.pid = i + 1;
+		init_mm(&mm[i], &proc);
+		flat[i] = calloc(PAGING_MAX_PGN, sizeof(uint32_t));
+		for (p = 0; p < pat->nr_pages; p++) {
+			pgn = p * pat->stride;
+			pte_set_fpn(pte_alloc(&mm[i], pgn), p);
+			pte_set_fpn(&flat[i][pgn], p);
+		}
+		for (dir = 0; dir < PAGING_PT_DIR_SZ; dir++) {
+			leaves += mm[i].pgd[dir] != NULL;
+		}
+	}
+	radix_kb = (PAGING_PT_DIR_SZ * sizeof(uint32_t *) +
+		(double)leaves / nr_procs * PAGING_PT_LEAF_SZ * sizeof(uint32_t)) / 1024;
+	flat_kb = PAGING_MAX_PGN * sizeof(uint32_t) / 1024.0;
+
+	/* Teardown as free_pcb_memph does it: visit the mapped PTEs, free */
+	t0 = bench_now();
+	for (i = 0; i < nr_procs; i++) {
+		pte_walk(&mm[i], 0, PAGING_MAX_PGN, count_pte, &mapped);
+		pgtbl_free(&mm[i]);
+	}
+	t1 = bench_now();
+	for (i = 0; i < nr_procs; i++) {
+		for (pgn = 0; pgn < PAGING_MAX_PGN; pgn++) {
+			flat_mapped += PAGING_PAGE_PRESENT(flat[i][pgn]) != 0;
+		}
+		free(flat[i]);
+	}
+	t2 = bench_now();
+
+	printf("  %-6s %5d pages   radix %5.1f KB %6.1f us   flat %5.1f KB %6.1f us"
+		"   %.0f / %.0f MB in all\n", pat->name, pat->nr_pages,
+		radix_kb, (t1 - t0) * 1e6 / nr_procs,
+		flat_kb, (t2 - t1) * 1e6 / nr_procs,
+		radix_kb * nr_procs / 1024, flat_kb * nr_procs / 1024);
+	if (mapped != flat_mapped || mapped != (long)pat->nr_pages * nr_procs) {
+		printf("  %s: %ld mapped PTEs, %ld in the flat table\n",
+			pat->name, mapped, flat_mapped);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		free(mm[i].mmap->vm_freerg_list);
+		free(mm[i].mmap);
+		pthread_mutex_destroy(&mm[i].lock);
+	}
+	free(flat);
+	free(mm);
+}
+
+int main(int argc, char * argv[]) {
+	int nr_procs = argc > 1 ? atoi(argv[1]) : FOOT_PROCS;
+	int i;
+
+	printf("pgtbl_footprint: %d processes, per process page table size "
+		"and teardown time\n", nr_procs);
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		foot_run(&patterns[i], nr_procs);
+	}
+	return 0;
+}
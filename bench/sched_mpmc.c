@@ -0,0 +1,109 @@
+/*
+ * sched_mpmc - throughput of the MLQ ready queue under contention.
+ * A loader thread keeps adding processes while [cpus] CPU threads
+ * dispatch and preempt them, as in the simulator. Built twice by the
+ * Makefile, with the mutex (sched_mpmc_mutex) and the lock-free
+ * (sched_mpmc_lockfree) MLQ levels.
+ *
+ * Usage: sched_mpmc_{mutex,lockfree} [operations per run]
+ */
+
+#include "bench.h"
+#include "mlq_sched.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef LOCKFREE_SCHED
+#define MPMC_NAME "lock-free"
+#else
+#define MPMC_NAME "mutex"
+#endif
+
+#define MPMC_OPS 4000000
+/* Processes queued before the run and added by the loader during it */
+#define MPMC_PROCS 256
+#define MPMC_NEW 65536
+
+static int cpus_tested[] = { 1, 4, 16, 64 };
+
+static long ops_per_cpu;
+static struct pcb_t * procs;
+static int go;
+
+static void * cpu_routine(void * arg) {
+	int id = (int)(long)arg;
+	long i, done = 0;
+	struct pcb_t * proc;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+	for (i = 0; i < ops_per_cpu; i++) {
+		if ((proc = get_proc(id)) != NULL) {
+			put_proc(id, proc);
+			done++;
+		}
+	}
+	return (void *)done;
+}
+
+static void * ld_routine(void * arg) {
+	int i;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		;
+	for (i = MPMC_PROCS; i < MPMC_PROCS + MPMC_NEW; i++) {
+		add_proc(&procs[i]);
+	}
+	return NULL;
+}
+
+int main(int argc, char * argv[]) {
+	long total_ops = argc > 1 ? atol(argv[1]) : MPMC_OPS;
+	int nr_procs = MPMC_PROCS + MPMC_NEW;
+	pthread_t cpu[64], ld;
+	int t, i, cpus;
+
+	procs = calloc(nr_procs, sizeof(struct pcb_t));
+	for (i = 0; i < nr_procs; i++) {
+		procs[i].pid = i + 1;
+		procs[i].prio = i % MAX_PRIO;
+	}
+
+	printf("sched_mpmc: %s MLQ, %ld get_proc+put_proc per run, "
+		"%d processes added meanwhile\n", MPMC_NAME, total_ops, MPMC_NEW);
+	for (t = 0; t < sizeof(cpus_tested) / sizeof(cpus_tested[0]); t++) {
+		void * ret;
+		long dispatched = 0;
+		double t0, t1;
+
+		cpus = cpus_tested[t];
+		ops_per_cpu = total_ops / cpus;
+		init_scheduler(cpus, nr_procs, 0);
+		for (i = 0; i < MAX_PRIO; i++) {
+			sched_bound_prio(i, (nr_procs + MAX_PRIO - 1 - i) / MAX_PRIO);
+		}
+		for (i = 0; i < MPMC_PROCS; i++) {
+			add_proc(&procs[i]);
+		}
+
+		go = 0;
+		for (i = 0; i < cpus; i++) {
+			pthread_create(&cpu[i], NULL, cpu_routine, (void *)(long)i);
+		}
+		pthread_create(&ld, NULL, ld_routine, NULL);
+		t0 = bench_now();
+		__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+		for (i = 0; i < cpus; i++) {
+			pthread_join(cpu[i], &ret);
+			dispatched += (long)ret;
+		}
+		pthread_join(ld, NULL);
+		t1 = bench_now();
+
+		printf("  %2d CPUs %12.0f dispatches/s\n", cpus, dispatched / (t1 - t0));
+		finish_scheduler();
+	}
+
+	free(procs);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * sched_stress - load many processes into one MLQ priority level and
+ * measure how fast the scheduler takes them in and dispatches them
+ *
+ * Usage: sched_stress [number of processes]
+ */
+
+#include "bench.h"
+#include "mlq_sched.h"
+#include <stdlib.h>
+
+#define STRESS_PROCS 100000
+#define STRESS_PRIO 70
+/* Dispatches of the preempt and redispatch phase, per process */
+#define STRESS_ROUNDS 10
+
+int main(int argc, char * argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : STRESS_PROCS;
+	struct pcb_t * procs, * proc;
+	double t0, t1, t2, t3;
+	long i, got = 0, fifo = 1;
+
+	if (n <= 0) {
+		printf("Usage: sched_stress [number of processes]\n");
+		return 1;
+	}
+	procs = calloc(n, sizeof(struct pcb_t));
+	init_scheduler(1, n, 0);
+
+	t0 = bench_now();
+	for (i = 0; i < n; i++) {
+		procs[i].pid = i + 1;
+		procs[i].prio = STRESS_PRIO;
+		add_proc(&procs[i]);
+	}
+
+	/* Dispatch every process once, in arrival order */
+	t1 = bench_now();
+	while ((proc = get_proc(0)) != NULL) {
+		if (proc != &procs[got]) {
+			fifo = 0;
+		}
+		got++;
+		put_proc(0, proc);
+		if (got == n) {
+			break;
+		}
+	}
+
+	/* Preempt and redispatch, as the CPUs do every time slice */
+	t2 = bench_now();
+	for (i = 0; i < (long)n * STRESS_ROUNDS; i++) {
+		proc = get_proc(0);
+		if (proc == NULL) {
+			break;
+		}
+		put_proc(0, proc);
+	}
+	t3 = bench_now();
+
+	printf("sched_stress: %d processes at priority %d\n", n, STRESS_PRIO);
+	printf("  add_proc          %12.0f procs/s\n", n / (t1 - t0));
+	printf("  first dispatch    %12.0f dispatches/s\n", got / (t2 - t1));
+	printf("  get_proc+put_proc %12.0f dispatches/s\n", i / (t3 - t2));
+	if (got != n || i != (long)n * STRESS_ROUNDS || !fifo) {
+		printf("  FAILED: %ld of %d processes dispatched, %s order\n",
+			got, n, fifo ? "FIFO" : "out of");
+		return 1;
+	}
+
+	finish_scheduler();
+	free(procs);
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * swap_cp - swap throughput of __swap_cp_page in pages per second.
+ * Pages go back and forth between RAM and a random access or a
+ * sequential swap device, once through the frame copy and once
+ * through the byte by byte MEMPHY_read/MEMPHY_write loop it replaced.
+ *
+ * Usage: swap_cp [pages per run]
+ */
+
+#include "bench.h"
+#include "mm.h"
+#include <stdlib.h>
+
+#define SWAP_PAGES 200000
+#define SWAP_RAM_SZ 0x100000
+#define SWAP_SWP_SZ 0x400000
+
+/* The byte copy __swap_cp_page used to do */
+static int swap_cp_bytes(struct memphy_struct * mpsrc, int srcfpn,
+		struct memphy_struct * mpdst, int dstfpn) {
+	int cellidx;
+	BYTE data;
+
+	for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++) {
+		MEMPHY_read(mpsrc, srcfpn * PAGING_PAGESZ + cellidx, &data);
+		MEMPHY_write(mpdst, dstfpn * PAGING_PAGESZ + cellidx, data);
+	}
+	return 0;
+}
+
+static void swap_run(const char * name, int rdmflg, long pages,
+		int (*cp)(struct memphy_struct *, int, struct memphy_struct *, int)) {
+	struct memphy_struct ram, swp;
+	int ramfp = SWAP_RAM_SZ / PAGING_PAGESZ;
+	int swpfp = SWAP_SWP_SZ / PAGING_PAGESZ;
+	unsigned int seed = 1;
+	double t0, t1;
+	long i;
+
+	init_memphy(&ram, SWAP_RAM_SZ, 1);
+	init_memphy(&swp, SWAP_SWP_SZ, rdmflg);
+
+	t0 = bench_now();
+	for (i = 0; i < pages; i += 2) {
+		/* Swap a page out to a scattered swap slot and back in */
+		int fpn = i % ramfp;
+		int swpfpn = (seed = seed * 1103515245 + 12345) % swpfp;
+
+		cp(&ram, fpn, &swp, swpfpn);
+		cp(&swp, swpfpn, &ram, (fpn + 1) % ramfp);
+	}
+	t1 = bench_now();
+
+	printf("  %-10s %-10s %12.0f pages/s", name,
+		rdmflg ? "random" : "sequential", pages / (t1 - t0));
+	if (!rdmflg) {
+		printf(" %8.1f seek units/page", (double)swp.seek_time / pages);
+	}
+	printf("\n");
+
+	free(ram.storage);
+	free(swp.storage);
+	free(ram.free_fp_stack);
+	free(swp.free_fp_stack);
+	free(ram.fp_tbl);
+	free(swp.fp_tbl);
+}
+
+int main(int argc, char * argv[]) {
+	long pages = argc > 1 ? atol(argv[1]) : SWAP_PAGES;
+
+	printf("swap_cp: %ld pages of %d bytes, %d KB RAM <-> %d KB swap\n",
+		pages, PAGING_PAGESZ, SWAP_RAM_SZ / 1024, SWAP_SWP_SZ / 1024);
+	swap_run("frame", 1, pages, __swap_cp_page);
+	swap_run("byte", 1, pages, swap_cp_bytes);
+	swap_run("frame", 0, pages, __swap_cp_page);
+	swap_run("byte", 0, pages, swap_cp_bytes);
+	return 0;
+}
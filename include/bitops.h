@@ -1,3 +1,6 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
 #ifdef CONFIG_64BIT
 #define BITS_PER_LONG 64
 #else
@@ -35,3 +38,52 @@
 #define NBITS(n) (n==0?0:NBITS32(n))
 
 #define EXTRACT_NBITS(nr, h, l) ((nr&GENMASK(h,l)) >> l)
+
+/*
+ * Flat bitmaps built of 64-bit words. Bit @nr lives in word nr / 64, so a
+ * bitmap of @nr bits needs BITMAP_WORDS(nr) words. Looking up the lowest
+ * set bit costs one find-first-set per word, i.e. O(1) for the small
+ * fixed-size maps we use (MAX_PRIO levels fit in 3 words).
+ */
+#define BITMAP_WORD_BITS        64
+#define BITMAP_WORDS(nr)        DIV_ROUND_UP(nr, BITMAP_WORD_BITS)
+
+#define BITMAP_SET(map, nr)     ((map)[(nr) / BITMAP_WORD_BITS] |= BIT_ULL((nr) % BITMAP_WORD_BITS))
+#define BITMAP_CLR(map, nr)     ((map)[(nr) / BITMAP_WORD_BITS] &= ~BIT_ULL((nr) % BITMAP_WORD_BITS))
+#define BITMAP_TEST(map, nr)    (((map)[(nr) / BITMAP_WORD_BITS] >> ((nr) % BITMAP_WORD_BITS)) & 1ULL)
+
+/* bitmap_fill - set the first @nbits bits of @map, clear the tail */
+static inline void bitmap_fill(unsigned long long *map, int nbits)
+{
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS(nbits); i++)
+		map[i] = ~0ULL;
+	if (nbits % BITMAP_WORD_BITS)
+		map[i - 1] = BIT_ULL(nbits % BITMAP_WORD_BITS) - 1;
+}
+
+/* bitmap_find_first - lowest set bit of @map, or -1 if none */
+static inline int bitmap_find_first(const unsigned long long *map, int nbits)
+{
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS(nbits); i++)
+		if (map[i])
+			return i * BITMAP_WORD_BITS + __builtin_ctzll(map[i]);
+	return -1;
+}
+
+/* bitmap_find_first_and - lowest bit set in both @a and @b, or -1 if none */
+static inline int bitmap_find_first_and(const unsigned long long *a,
+		const unsigned long long *b, int nbits)
+{
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS(nbits); i++)
+		if (a[i] & b[i])
+			return i * BITMAP_WORD_BITS + __builtin_ctzll(a[i] & b[i]);
+	return -1;
+}
+
+#endif /* BITOPS_H */
@@ -4,6 +4,7 @@
 /* Define structs and routine could be used by every source files */
 
 #include <stdint.h>
+#include <pthread.h>
 
 #ifndef OSCFG_H
 #include "os-cfg.h"
@@ -39,9 +40,30 @@ struct inst_t {
 	uint32_t arg_2;
 };
 
+struct pcb_t;
+struct dinst_t;
+
+/* Executes a decoded instruction, returns 0 on success */
+typedef int (*inst_handler_t)(struct pcb_t * proc, const struct dinst_t * ins);
+
+/* Decoded instruction: the handler of the opcode, chosen once for the
+ * memory backend in use, next to the operands */
+struct dinst_t {
+	inst_handler_t handler;
+	uint32_t arg_0;
+	uint32_t arg_1;
+	uint32_t arg_2;
+	uint32_t calc_run;	// CALCs in a row from here, 0 if not a CALC
+};
+
 struct code_seg_t {
 	struct inst_t * text;
 	uint32_t size;
+	/* Decoded text (see decode()), NULL until the first decode */
+	struct dinst_t * dtext;
+	/* Length of the mapping of a compiled program text points into,
+	 * 0 if text was malloc'ed */
+	size_t map_sz;
 };
 
 struct trans_table_t {
@@ -4,10 +4,23 @@
 
 #include "common.h"
 
+/* Build the decoded form of a code segment, once even when several
+ * threads race on a shared segment. Return 0 on success */
+int decode(struct code_seg_t * code);
+
 /* Execute an instruction of a process. Return 0
  * if the instruction is executed successfully.
  * Otherwise, return 1. */
 int run(struct pcb_t * proc);
 
+/* Execute up to n instructions of a process, stopping at the end of
+ * its code. Return the status of the last one as run() does, 1 if its
+ * code cannot be decoded */
+int run_slice(struct pcb_t * proc, uint32_t n);
+
+/* Number of CALC instructions in a row at the pc of a process. They
+ * only take time, a CPU may retire them all in one step */
+uint32_t calc_run(struct pcb_t * proc);
+
 #endif
 
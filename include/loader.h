@@ -3,7 +3,27 @@
 
 #include "common.h"
 
+/* Compiled program (see progc): a header followed by size packed
+ * struct inst_t, in the byte order of the machine that compiled it */
+#define PROG_MAGIC	0x676f7270	/* "prog" */
+#define PROG_VERSION	1
+
+struct prog_hdr_t {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t inst_size;	// sizeof(struct inst_t)
+	uint32_t priority;
+	uint32_t size;		// Number of instructions
+};
+
+/* Build the PCB of a program, its PID is given by assign_pid() */
 struct pcb_t * load(const char * path);
 
+/* Give a loaded process the next PID, in the order processes start */
+void assign_pid(struct pcb_t * proc);
+
+/* Release a process loaded by load(), its code once no process uses it */
+void unload(struct pcb_t * proc);
+
 #endif
 
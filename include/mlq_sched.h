@@ -0,0 +1,42 @@
+#ifndef MLQ_SCHED_H
+#define MLQ_SCHED_H
+
+#include "common.h"
+
+#ifndef MLQ_SCHED
+#define MLQ_SCHED
+#endif
+
+#ifndef MAX_PRIO
+#define MAX_PRIO 139
+#endif
+
+int queue_empty(void);
+
+/* Set up the ready queues for [num_cpus] CPUs and at most [max_procs]
+ * processes. With [percpu] set each CPU gets its own MLQ, otherwise
+ * one MLQ is shared by all. Built with LOCKFREE_SCHED the MLQ levels
+ * are fixed size lock-free queues, of [max_procs] cells unless bounded
+ * by sched_bound_prio().
+ *
+ * LOCKFREE_SCHED stays off by default: bench/sched_mpmc_lockfree has
+ * not beaten bench/sched_mpmc_mutex in any run so far (the CAS loops
+ * and the SEQ_CST bitmap updates cost more than the uncontended run
+ * queue lock). It is kept for hosts where that lock is contended */
+void init_scheduler(int num_cpus, int max_procs, int percpu);
+void finish_scheduler(void);
+
+/* At most [nr] processes have priority [prio], the lock-free levels of
+ * that priority are sized by it. Call before adding any of them */
+void sched_bound_prio(int prio, int nr);
+
+/* Get the next process to run on CPU [cpu] from ready queue */
+struct pcb_t * get_proc(int cpu);
+
+/* Put a process preempted on CPU [cpu] back to run queue */
+void put_proc(int cpu, struct pcb_t * proc);
+
+/* Add a new process to ready queue */
+void add_proc(struct pcb_t * proc);
+
+#endif
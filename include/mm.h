@@ -15,12 +15,23 @@
 #define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
+
+/* Two level page table, a PGN splits into [ directory | leaf ] indexes
+ * and leaf tables are only allocated for the touched ranges */
+#define PAGING_PT_LEAF_BITS 7
+#define PAGING_PT_LEAF_SZ BIT(PAGING_PT_LEAF_BITS)
+#define PAGING_PT_DIR_SZ DIV_ROUND_UP(PAGING_MAX_PGN, PAGING_PT_LEAF_SZ)
+#define PAGING_PT_DIR(pgn) ((pgn) >> PAGING_PT_LEAF_BITS)
+#define PAGING_PT_LEAF(pgn) ((pgn) & (PAGING_PT_LEAF_SZ - 1))
+#define PAGING_PT_LEVELS 2
 /* PTE BIT */
 #define PAGING_PTE_PRESENT_MASK BIT(31) 
 #define PAGING_PTE_SWAPPED_MASK BIT(30)
 #define PAGING_PTE_RESERVE_MASK BIT(29)
 #define PAGING_PTE_DIRTY_MASK BIT(28)
-#define PAGING_PTE_EMPTY01_MASK BIT(14)
+/* Accessed bit, set on every access and consumed by page replacement.
+ * It takes the reserved bit: bits 0-25 hold the FPN or the swap fields */
+#define PAGING_PTE_ACCESSED_MASK PAGING_PTE_RESERVE_MASK
 #define PAGING_PTE_EMPTY02_MASK BIT(13)
 
 /* PTE BIT PRESENT */
@@ -88,6 +99,12 @@
 /* Extract SWAPTYPE */
 #define PAGING_FPN(x)  GETVAL(x,PAGING_FPN_MASK,PAGING_ADDR_FPN_LOBIT)
 
+/* Extract fields of a PTE (the macros above work on addresses) */
+#define PAGING_PTE_FPN(pte)     GETVAL(pte,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
+#define PAGING_PTE_SWPTYP(pte)  GETVAL(pte,PAGING_PTE_SWPTYP_MASK,PAGING_PTE_SWPTYP_LOBIT)
+#define PAGING_PTE_SWPOFF(pte)  GETVAL(pte,PAGING_PTE_SWPOFF_MASK,PAGING_PTE_SWPOFF_LOBIT)
+#define PAGING_PAGE_SWAPPED(pte) (pte&PAGING_PTE_SWAPPED_MASK)
+
 /* Memory range operator */
 #define INCLUDE(x1,x2,y1,y2) (((y1-x1)*(x2-y2)>=0)?1:0)
 #define OVERLAP(x1,x2,y1,y2) (((y2-x1)*(x2-y1)>=0)?1:0)
@@ -96,13 +113,23 @@ extern pthread_mutex_t mem_lock;
 /* VM region prototypes */
 struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
-int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
+int enlist_frame(struct pcb_t *caller, int fpn, int pgn);
+int delist_frame(struct pcb_t *caller, int fpn);
+int enlist_fifo_frame(struct mm_struct *mm, struct framephy_struct *fp);
+int delist_fifo_frame(struct mm_struct *mm, struct framephy_struct *fp);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
-                    struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
+                    int *frames, struct vm_rg_struct *ret_rg);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
-int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
+int alloc_pages_range(struct pcb_t *caller, int incpgnum, int *frm_lst);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) ;
+uint32_t *pte_lookup(struct mm_struct *mm, int pgn);
+uint32_t *pte_alloc(struct mm_struct *mm, int pgn);
+uint32_t pte_get(struct mm_struct *mm, int pgn);
+int pte_walk(struct mm_struct *mm, int start, int end,
+             int (*fn)(struct mm_struct *mm, int pgn, uint32_t *pte, void *arg),
+             void *arg);
+int pgtbl_free(struct mm_struct *mm);
 int pte_set_fpn(uint32_t *pte, int fpn);
 int pte_set_swap(uint32_t *pte, int swptyp, int swpoff);
 int init_pte(uint32_t *pte,
@@ -116,7 +143,10 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller);
+int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int free_pcb_memph(struct pcb_t *caller);
 
 /* CPUTLB prototypes */
 int check_if_in_freerg_list(struct pcb_t *caller, int vmaid, struct vm_rg_struct *currg);
@@ -126,7 +156,7 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index);
 int tlbread(struct pcb_t * proc, uint32_t source, uint32_t offset, uint32_t destination) ;
 int tlbwrite(struct pcb_t * proc, BYTE data, uint32_t destination, uint32_t offset);
-int init_tlbmemphy(struct memphy_struct *mp, int max_size);
+int init_tlbmemphy(struct memphy_struct *mp, int max_size, int ways);
 int TLBMEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int TLBMEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
 int TLBMEMPHY_dump(struct memphy_struct * mp);
@@ -150,14 +180,42 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
 int find_victim_page(struct mm_struct* mm, int *pgn);
+int __swap_out_victim(struct pcb_t *caller, int *retfpn);
+#ifdef MM_KSWAPD
+#ifndef MM_GLOBAL_RECLAIM
+#error "MM_KSWAPD reclaims from the global lists, it needs MM_GLOBAL_RECLAIM"
+#endif
+int kswapd_reclaim(struct memphy_struct *mram, struct memphy_struct *mswp);
+#endif
+
+/* Page replacement policy, see mm-policy.c */
+struct pgrep_policy {
+   const char *name;
+   int (*victim)(struct mm_struct *mm, int *retpgn);
+};
+extern struct pgrep_policy *pgrep;
+int pgrep_select(const char *name);
+void pgrep_account(int fault, int swpout, int swpin);
+void pgrep_account_bg(int fault_free, int bg_swpout);
+int pgrep_report(void);
+int lru_add_frame(struct memphy_struct *mp, struct framephy_struct *fp);
+int lru_del_frame(struct memphy_struct *mp, struct framephy_struct *fp);
+int lru_reclaim(struct memphy_struct *mp, struct mm_struct *self,
+                struct mm_struct **retmm, int *retpgn);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
+int MEMPHY_get_freefp_n(struct memphy_struct *mp, int n, int *fpns);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
+int MEMPHY_nr_freefp(struct memphy_struct *mp);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
+int MEMPHY_read_frame(struct memphy_struct *mp, int fpn, BYTE *buf);
+int MEMPHY_write_frame(struct memphy_struct *mp, int fpn, const BYTE *buf);
 int MEMPHY_dump(struct memphy_struct * mp);
+int MEMPHY_seek_stats(struct memphy_struct *mp, const char *name);
+int MEMPHY_seek_slots(void);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
 /* DEBUG */
 int print_list_fp(struct framephy_struct *fp);
@@ -169,8 +227,12 @@ int print_list_pgn(struct pgn_t *ip);
 int print_pgtbl(struct pcb_t *ip, uint32_t start, uint32_t end);
 
 #ifdef CPU_TLB
-int tlb_cache_read(struct memphy_struct *mp, int pid, int pgnum, BYTE *value);
-int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, BYTE value);
+int tlb_cache_read(struct memphy_struct *mp, int pid, int pgnum, int *fpn);
+int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, int fpn);
+int tlb_report(void);
 int tlb_clear_tlb_entry(struct memphy_struct *mp, int pid, int pgnum);
+int tlb_shootdown(struct memphy_struct *self, int pid, int pgnum);
+int tlb_shootdown_sync(int pid, int pgnum, int *users);
+int tlb_shootdown_flush(struct memphy_struct *mp);
 #endif
 #endif
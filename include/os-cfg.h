@@ -3,11 +3,44 @@
 
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
+/* Default to per-CPU MLQ run queues, os --sched=global|percpu overrides */
+//#define SCHED_PERCPU
 
 #define CPU_TLB
-#define CPUTLB_FIXED_TLBSZ
+/* Ignore the TLB line of the config file, CPUTLB_DEFAULT_SZ/WAYS apply */
+//#define CPUTLB_FIXED_TLBSZ
+/* TLB geometry when the config file has no TLB line: entries, ways */
+#define CPUTLB_DEFAULT_SZ 8
+#define CPUTLB_DEFAULT_WAYS 1
+/* Simulated translation cost: a TLB lookup, plus one memory access per
+ * page table level on a miss */
+#define CPUTLB_LOOKUP_CYCLES 1
+#define CPUTLB_WALK_CYCLES 10
 #define MM_PAGING
 //#define MM_FIXED_MEMSZ
+//#define MM_SWP_SEQUENTIAL
+/* Seek cost of a sequential MEMPHY: fixed latency plus 1 unit per RATE bytes,
+ * the CPU that caused the seeks stays busy 1 slot per SLOT_TIME units */
+#define MEMPHY_SEEK_LATENCY 10
+#define MEMPHY_SEEK_RATE 256
+#define MEMPHY_SEEK_SLOT_TIME 1024
+/* Reclaim the coldest frame of the whole RAM instead of a victim of
+ * the faulting process, the config file policy is then unused */
+//#define MM_GLOBAL_RECLAIM
+/* Background reclaim thread (needs MM_GLOBAL_RECLAIM), it swaps out cold
+ * pages once fewer than LOW percent of the RAM frames are free, up to HIGH */
+//#define MM_KSWAPD
+#define KSWAPD_LOW_WMARK_PCT 5
+#define KSWAPD_HIGH_WMARK_PCT 10
+/* Working set window of the wsclock policy, in memory accesses */
+#define PAGING_WSCLOCK_TAU 16
+/* Retire a run of CALC instructions in one step, the CPU tells the
+ * timer it is busy for that many slots. Same output as one per slot */
+//#define CPU_CALC_BATCH
+/* Loader threads building the PCBs of upcoming processes, at most
+ * PREFETCH processes ahead of the next one to start */
+#define LOADER_WORKERS 2
+#define LOADER_PREFETCH 8
 //#define VMDBG 1
 //#define MMDBG 1
 #define IODUMP 1
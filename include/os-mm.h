@@ -4,6 +4,7 @@
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
 #define PAGING_MAX_SYMTBL_SZ 30
+#define TLB_SHOOTDOWN_BATCH 16 /* queued invalidations before a full flush */
 
 typedef char BYTE;
 typedef uint32_t addr_t;
@@ -46,15 +47,34 @@ struct vm_area_struct {
  * Memory management struct
  */
 struct mm_struct {
-   uint32_t *pgd;
+   /* Guards every field below, see the lock order in mm-vm.c */
+   pthread_mutex_t lock;
+
+   /* Address space id, the pid of the owner, tags its TLB entries */
+   int asid;
+
+   /* Page directory of PAGING_PT_DIR_SZ leaf tables, NULL if untouched */
+   uint32_t **pgd;
 
    struct vm_area_struct *mmap;
 
    /* Currently we support a fixed number of symbol */
    struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
 
-   /* list of free page */
-   struct pgn_t *fifo_pgn;
+   /* FIFO of the resident pages, linked through the RAM frame table:
+    * fifo_head is the oldest page, the next victim */
+   struct framephy_struct *fifo_head;
+   struct framephy_struct *fifo_tail;
+
+   /* Virtual time, counts the memory accesses of the mm */
+   unsigned long vtime;
+
+   /* Set while the owner runs on a CPU, whose TLB hits use its frames
+    * without the lock: another thread swapping its pages out has to
+    * shoot them down synchronously (see tlb_shootdown_sync) */
+   int on_cpu;
+   /* TLB hits between translation and memory access */
+   int tlb_users;
 };
 
 /*
@@ -63,9 +83,38 @@ struct mm_struct {
 struct framephy_struct { 
    int fpn;
    struct framephy_struct *fp_next;
+   struct framephy_struct *fp_prev;
 
    /* Resereed for tracking allocated framed */
    struct mm_struct* owner;
+   int pgn;
+
+   /* Page replacement state */
+   uint32_t age;
+   unsigned long last_use;
+   int active;
+};
+
+/*
+ * TLB entry, caches the frame of a page of a process. key packs
+ * valid | pid | pgn (see TLB_KEY) so a lookup compares one word.
+ * Writers make seq odd while they update key and value, readers
+ * retry until they saw an even, unchanged seq
+ */
+struct tlb_entry_struct {
+   unsigned int seq;
+   uint64_t key;
+   uint32_t value; /* FPN */
+   /* LRU stamp, the entry with the lowest one leaves its set first */
+   unsigned long last_use;
+};
+
+/*
+ * TLB shootdown request, invalidates page pgn of address space pid
+ */
+struct tlb_shootdown_struct {
+   int pid;
+   int pgn;
 };
 
 struct memphy_struct {
@@ -76,10 +125,44 @@ struct memphy_struct {
    /* Sequential device fields */ 
    int rdmflg;
    int cursor;
-
-   /* Management structure */
-   struct framephy_struct *free_fp_list;
+   /* Seek cost accounting, see MEMPHY_mv_csr */
+   uint64_t seek_cnt;
+   uint64_t seek_dist;
+   uint64_t seek_time;
+
+   /* Management structure: free frame numbers are kept on a stack,
+    * free_fp_stack[free_fp_top - 1] is the next frame handed out */
+   pthread_mutex_t fp_lock;
+   int *free_fp_stack;
+   int free_fp_top;
+   int numfp;
    struct framephy_struct *used_fp_list;
+   /* Frame table, fp_tbl[fpn] describes frame fpn */
+   struct framephy_struct *fp_tbl;
+
+   /* System wide active/inactive frame lists, see MM_GLOBAL_RECLAIM */
+   struct framephy_struct *active_head, *active_tail;
+   struct framephy_struct *inactive_head, *inactive_tail;
+   int nr_active, nr_inactive;
+
+   /* Set associative TLB, set s holds tlb_ent[s * tlb_ways ...] and
+    * counts its lookups in tlb_hit[s] / tlb_miss[s]. Lookups take no
+    * lock, tlb_lock only orders the writers */
+   pthread_mutex_t tlb_lock;
+   struct tlb_entry_struct *tlb_ent;
+   int tlb_sets;
+   int tlb_ways;
+   unsigned long tlb_clock;
+   unsigned long *tlb_hit;
+   unsigned long *tlb_miss;
+
+   /* Shootdowns sent by other CPUs, applied by the owner CPU at the
+    * start of its next slot; more than TLB_SHOOTDOWN_BATCH of them
+    * flush the whole TLB. tlb_next links the TLBs of all CPUs */
+   pthread_mutex_t tlb_sd_lock;
+   struct tlb_shootdown_struct *tlb_sd;
+   int tlb_nr_sd;
+   struct memphy_struct *tlb_next;
 };
 
 #endif
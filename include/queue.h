@@ -4,18 +4,52 @@
 
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+/* Initial number of slots of a queue, it doubles whenever it is full */
+#define QUEUE_INIT_CAP 8
 
+/* FIFO of PCBs kept in a growable ring buffer. A zero-filled queue_t
+ * is a valid empty queue, storage is allocated on first enqueue. */
 struct queue_t {
-	struct pcb_t * proc[MAX_QUEUE_SIZE];
-	int size;
+	struct pcb_t ** proc;	// Ring buffer of [cap] slots
+	int head;		// Index of the oldest process
+	int size;		// Number of queued processes
+	int cap;		// Number of allocated slots
 };
 
+void init_queue(struct queue_t * q);
+
+void free_queue(struct queue_t * q);
+
 void enqueue(struct queue_t * q, struct pcb_t * proc);
 
 struct pcb_t * dequeue(struct queue_t * q);
 
 int empty(struct queue_t * q);
 
+/* Bounded lock-free multi-producer/multi-consumer FIFO of PCBs
+ * (array of cells tagged with sequence numbers). [cap] is rounded up
+ * to a power of two; lf_enqueue() fails when the queue is full. */
+struct lf_cell_t {
+	unsigned long seq;
+	struct pcb_t * proc;
+};
+
+struct lf_queue_t {
+	struct lf_cell_t * cells;
+	unsigned long mask;
+	unsigned long head __attribute__((aligned(64)));	// Next cell to dequeue
+	unsigned long tail __attribute__((aligned(64)));	// Next cell to enqueue
+};
+
+int lf_queue_init(struct lf_queue_t * q, unsigned long cap);
+
+void lf_queue_free(struct lf_queue_t * q);
+
+int lf_enqueue(struct lf_queue_t * q, struct pcb_t * proc);
+
+struct pcb_t * lf_dequeue(struct lf_queue_t * q);
+
+int lf_empty(struct lf_queue_t * q);
+
 #endif
 
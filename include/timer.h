@@ -4,13 +4,21 @@
 #include <pthread.h>
 #include <stdint.h>
 
+/* Wake-up time of a device that only waits for other devices */
+#define TIMER_NEVER UINT64_MAX
+
 struct timer_id_t {
 	int done;
 	int fsh;
+	uint64_t idle_until;	// 0 if busy in the current slot
+	uint64_t busy_until;	// Slot it is back in, see next_slot_busy()
 	pthread_cond_t event_cond;
 	pthread_mutex_t event_lock;
 	pthread_cond_t timer_cond;
 	pthread_mutex_t timer_lock;
+#ifdef TIMER_BARRIER
+	int sense;	// Local sense of the tick barrier
+#endif
 };
 
 void start_timer();
@@ -23,6 +31,24 @@ void detach_event(struct timer_id_t * event);
 
 void next_slot(struct timer_id_t* timer_id);
 
+/* Same as next_slot() for a device with nothing to do before time
+ * [wake]. When every device idles, a TIMER_FASTFWD build jumps the
+ * clock straight to the earliest wake-up instead of ticking through
+ * the empty slots */
+void next_slot_idle(struct timer_id_t* timer_id, uint64_t wake);
+
+/* Same as next_slot() for a device that already did the work of the
+ * next [slots] - 1 slots too. It counts as busy in all of them but is
+ * not waited for, it is back in slot current_time() + [slots] */
+void next_slot_busy(struct timer_id_t* timer_id, uint64_t slots);
+
 uint64_t current_time();
 
+/* Clock of the single-threaded backend: sim_start() opens slot 0 and
+ * sim_advance() moves on to slot [t], reporting skipped slots the way
+ * the threaded engines would */
+void sim_start();
+
+void sim_advance(uint64_t t);
+
 #endif
@@ -17,7 +17,6 @@
 #include <stdio.h>
 #include <pthread.h>
 #ifdef CPU_TLB
-static pthread_mutex_t cpu_tlb = PTHREAD_MUTEX_INITIALIZER;
 int tlb_change_all_page_tables_of(struct pcb_t *proc, struct memphy_struct *mp)
 {
   /* TODO update all page table directory info
@@ -40,7 +39,6 @@ int tlb_flush_tlb_of(struct pcb_t *proc, struct memphy_struct *mp)
  */
 int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
 {
-  pthread_mutex_lock(&cpu_tlb);
   int addr, val;
 
   /* By default using vmaid = 0 */
@@ -49,7 +47,6 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
   /* TODO update TLB CACHED frame num of the new allocated page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
   TLBMEMPHY_dump(proc->tlb);
-  pthread_mutex_unlock(&cpu_tlb);
   return val;
 }
 
@@ -60,12 +57,85 @@ int tlballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
  */
 int tlbfree_data(struct pcb_t *proc, uint32_t reg_index)
 {
-  pthread_mutex_lock(&cpu_tlb);
   __free(proc, 0, reg_index);
   /* TODO update TLB CACHED frame num of freed page(s)*/
   /* by using tlb_cache_read()/tlb_cache_write()*/
   TLBMEMPHY_dump(proc->tlb);
-  pthread_mutex_unlock(&cpu_tlb);
+  return 0;
+}
+
+/* Translation cost counters, shown by tlb_report */
+static unsigned long nr_tlb_hit, nr_tlb_miss;
+static unsigned long tlb_hit_cycles, tlb_miss_cycles;
+
+/*tlb_translate - look the frame of a page up in the TLB
+ *@proc: Process executing the instruction
+ *@region: accessed region
+ *@page: accessed page
+ *
+ * Return the cached FPN or -1 on a miss. A region not in use never
+ * hits, the slow path reports the bad access
+ */
+static int tlb_translate(struct pcb_t *proc, struct vm_rg_struct *region, int page)
+{
+  int fpn = -1;
+
+  if (region != NULL && region->rg_start < region->rg_end &&
+      tlb_cache_read(proc->tlb, proc->pid, page, &fpn) == 0)
+  {
+    /* Keep the page replacement informed as the walk would */
+    __atomic_fetch_or(pte_lookup(proc->mm, page), PAGING_PTE_ACCESSED_MASK,
+                      __ATOMIC_RELAXED);
+    __atomic_fetch_add(&proc->mm->vtime, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&nr_tlb_hit, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tlb_hit_cycles, CPUTLB_LOOKUP_CYCLES, __ATOMIC_RELAXED);
+    return fpn;
+  }
+
+  __atomic_fetch_add(&nr_tlb_miss, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&tlb_miss_cycles,
+                     CPUTLB_LOOKUP_CYCLES + PAGING_PT_LEVELS * CPUTLB_WALK_CYCLES,
+                     __ATOMIC_RELAXED);
+  return -1;
+}
+
+/*tlb_fill - cache the frame of a page the slow path brought in
+ *@proc: Process executing the instruction
+ *@page: accessed page
+ *
+ * Under the mm lock: a reclaim from another thread may have taken the
+ * page since the slow path released it
+ */
+static void tlb_fill(struct pcb_t *proc, int page)
+{
+  uint32_t pte;
+
+  pthread_mutex_lock(&proc->mm->lock);
+  pte = pte_get(proc->mm, page);
+  if (PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte))
+    tlb_cache_write(proc->tlb, proc->pid, page, PAGING_PTE_FPN(pte));
+  pthread_mutex_unlock(&proc->mm->lock);
+}
+
+/* A hit uses its frame without the mm lock, from translation to the
+ * memory access it is counted so that reclaim can wait it out */
+static void tlb_hit_begin(struct mm_struct *mm)
+{
+  __atomic_fetch_add(&mm->tlb_users, 1, __ATOMIC_RELAXED);
+  /* Pairs with the fence of tlb_shootdown_sync */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void tlb_hit_end(struct mm_struct *mm)
+{
+  __atomic_fetch_sub(&mm->tlb_users, 1, __ATOMIC_RELEASE);
+}
+
+int tlb_report(void)
+{
+  printf("TLB: %lu hits in %lu cycles, %lu misses in %lu cycles\n",
+         nr_tlb_hit, tlb_hit_cycles, nr_tlb_miss, tlb_miss_cycles);
+
   return 0;
 }
 
@@ -74,30 +144,37 @@ int tlbfree_data(struct pcb_t *proc, uint32_t reg_index)
  *@source: index of source register
  *@offset: source address = [source] + [offset]
  *@destination: destination storage
+ *
+ * A hit reads the RAM frame right away, without the mm lock
  */
 int tlbread(struct pcb_t *proc, uint32_t source,
             uint32_t offset, uint32_t destination)
 {
   BYTE data = -1;
-  int frmnum = -1, val = 0;
-  /* TODO retrieve TLB CACHED frame num of accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-  /* frmnum is return value of tlb_cache_read/write value*/
+  int frmnum, val = 0;
   struct vm_rg_struct *region = get_symrg_byid(proc->mm, source);
-  if (check_if_in_freerg_list(proc, 0, region) < 0)
+
+  if (region == NULL)
   {
     printf("REGION READ NULL\n");
     return -1;
   }
   int addr = region->rg_start + offset;
-
   int page = PAGING_PGN(addr);
 
-  tlb_cache_read(proc->tlb, proc->pid, page, &frmnum);
+  tlb_hit_begin(proc->mm);
+  frmnum = tlb_translate(proc, region, page);
+  if (frmnum < 0)
+    tlb_hit_end(proc->mm);
+  if (frmnum < 0 && check_if_in_freerg_list(proc, 0, region) < 0)
+  {
+    printf("REGION READ NULL\n");
+    return -1;
+  }
 #ifdef IODUMP
   if (frmnum >= 0)
   {
-    printf("TLB hit at read region=%d offset=(%d\n",
+    printf("TLB hit at read region=%d offset=%d\n",
            source, offset);
   }
   else
@@ -113,23 +190,23 @@ int tlbread(struct pcb_t *proc, uint32_t source,
 
   if (frmnum >= 0)
   {
-    int physical_addr = (frmnum << PAGING_ADDR_FPN_HIBIT) + offset;
+    int physical_addr = (frmnum << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
     MEMPHY_read(proc->mram, physical_addr, &data);
+    tlb_hit_end(proc->mm);
   }
   else
   {
+    /* Nothing to cache when the page could not be brought in, the
+     * error goes up to the CPU */
     val = __read(proc, 0, source, offset, &data);
     if (val == 0)
     {
-      tlb_cache_write(proc->tlb, proc->pid, page, data);
+      tlb_fill(proc, page);
     }
     TLBMEMPHY_dump(proc->tlb);
   }
   destination = (uint32_t)data;
 
-  /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
-
   return val;
 }
 
@@ -138,16 +215,15 @@ int tlbread(struct pcb_t *proc, uint32_t source,
  *@data: data to be wrttien into memory
  *@destination: index of destination register
  *@offset: destination address = [destination] + [offset]
+ *
+ * A hit writes the RAM frame right away, without the mm lock
  */
 int tlbwrite(struct pcb_t *proc, BYTE data,
              uint32_t destination, uint32_t offset)
 {
-  int val = 0;
-  BYTE frmnum = -1;
-  /* TODO retrieve TLB CACHED frame num of accessing page(s))*/
-  /* by using tlb_cache_read()/tlb_cache_write()
-  frmnum is return value of tlb_cache_read/write value*/
+  int frmnum, val = 0;
   struct vm_rg_struct *region = get_symrg_byid(proc->mm, (int)destination);
+
   if (region == NULL)
   {
     printf("REGION WRITE NULL\n");
@@ -156,8 +232,11 @@ int tlbwrite(struct pcb_t *proc, BYTE data,
 
   int addr = region->rg_start + offset;
   int page = PAGING_PGN(addr);
-  frmnum = PAGING_FPN(page);
-  tlb_cache_write(proc->tlb, proc->pid, page, frmnum);
+
+  tlb_hit_begin(proc->mm);
+  frmnum = tlb_translate(proc, region, page);
+  if (frmnum < 0)
+    tlb_hit_end(proc->mm);
 
 #ifdef IODUMP
   if (frmnum >= 0)
@@ -178,22 +257,21 @@ int tlbwrite(struct pcb_t *proc, BYTE data,
 
   if (frmnum >= 0)
   {
-
-    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + offset;
+    int phyaddr = (frmnum << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
     MEMPHY_write(proc->mram, phyaddr, data);
+    tlb_hit_end(proc->mm);
   }
   else
   {
+    /* Nothing to cache when the page could not be brought in, the
+     * error goes up to the CPU */
     val = __write(proc, 0, destination, offset, data);
     if (val == 0)
     {
-      // printf("pid: %d page: %d value: %d 333333333333333333333333\n", proc->pid, page, data);
-      tlb_cache_write(proc->tlb, proc->pid, page, data);
+      tlb_fill(proc, page);
     }
     TLBMEMPHY_dump(proc->tlb);
   }
-  /* TODO update TLB CACHED with frame num of recent accessing page(s)*/
-  /* by using tlb_cache_read()/tlb_cache_write()*/
   return val;
 }
 
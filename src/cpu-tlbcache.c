@@ -20,70 +20,218 @@
 #include "mm.h"
 #include <stdlib.h>
 #include<stdio.h>
-#define GET_TAG(tlb_page) GETVAL(tlb_page, GENMASK(8, 0), 0)
-#define GET_PID(tlb_page) GETVAL(tlb_page, GENMASK(29, 9), 9)
-#define GET_VALID(tlb_page) GETVAL(tlb_page, BIT(30), 30)
-#define init_tlbcache(mp, sz, ...) init_memphy(mp, sz, (1, ##__VA_ARGS__))
-#define SET_PID(tlb_page, pid) SETVAL(tlb_page, pid, GENMASK(29, 9), 9)
-#define SET_TAG(tlb_page, tag) SETVAL(tlb_page, tag, GENMASK(8, 0), 0)
-#define init_tlbcache(mp,sz,...) init_memphy(mp, sz, (1, ##__VA_ARGS__))
+
 /*
-bit 31: TAG USED
-bit 30: VALID
-bit 29-9: PID
-bit 8-0: TAG
+ * The TLB has tlb_sets sets of tlb_ways entries, page pgnum of any
+ * process maps to set pgnum % tlb_sets and the least recently used
+ * entry of a full set is replaced
+ */
+#define TLB_SET(mp, pgnum) (&(mp)->tlb_ent[((pgnum) % (mp)->tlb_sets) * (mp)->tlb_ways])
+
+/* Packed entry key: bit 63 valid, bits 62-32 pid, bits 31-0 pgn */
+#define TLB_KEY_VALID (1ULL << 63)
+#define TLB_KEY(pid, pgn) (TLB_KEY_VALID | ((uint64_t)(pid) << 32) | (uint32_t)(pgn))
+#define TLB_KEY_PID(key) ((int)(((key) & ~TLB_KEY_VALID) >> 32))
 
-*/
-#define MAX_TLB 8
-static uint32_t *tlb[MAX_TLB];
-static pthread_mutex_t tlb_lock;
+/* TLBs of all CPUs, set up before any CPU runs */
+static struct memphy_struct *tlb_list;
 
 /*
- *  tlb_cache_read read TLB cache device
+ *  tlb_entry_get - read a consistent copy of an entry, lock free
+ *  @ent: TLB entry
+ *  @key: obtained key
+ *  @value: obtained value
+ */
+static void tlb_entry_get(struct tlb_entry_struct *ent, uint64_t *key, uint32_t *value)
+{
+   unsigned int seq;
+
+   do {
+      seq = __atomic_load_n(&ent->seq, __ATOMIC_ACQUIRE);
+      *key = __atomic_load_n(&ent->key, __ATOMIC_RELAXED);
+      *value = __atomic_load_n(&ent->value, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   } while ((seq & 1) || seq != __atomic_load_n(&ent->seq, __ATOMIC_RELAXED));
+}
+
+/*
+ *  tlb_entry_set - update an entry, tlb_lock held
+ *  @ent: TLB entry
+ *  @key: new key, 0 invalidates
+ *  @value: new value
+ */
+static void tlb_entry_set(struct tlb_entry_struct *ent, uint64_t key, uint32_t value)
+{
+   __atomic_store_n(&ent->seq, ent->seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   __atomic_store_n(&ent->key, key, __ATOMIC_RELAXED);
+   __atomic_store_n(&ent->value, value, __ATOMIC_RELAXED);
+   __atomic_store_n(&ent->seq, ent->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ *  tlb_lookup - find the entry of a page in its set, tlb_lock held
  *  @mp: memphy struct
  *  @pid: process id
  *  @pgnum: page number
- *  @value: obtained value
  */
+static struct tlb_entry_struct *tlb_lookup(struct memphy_struct *mp, int pid, int pgnum)
+{
+   struct tlb_entry_struct *set = TLB_SET(mp, pgnum);
+   uint64_t key = TLB_KEY(pid, pgnum);
+   int way;
+
+   /* Entries only change under the lock, plain reads are stable */
+   for (way = 0; way < mp->tlb_ways; way++)
+     if (set[way].key == key)
+       return &set[way];
+
+   return NULL;
+}
 
 /*
- *  tlb_cache_read read TLB cache device
+ *  tlb_clear_tlb_entry - invalidate the cached translation of a page
  *  @mp: memphy struct
  *  @pid: process id
  *  @pgnum: page number
- *  @value: obtained value
  */
+int tlb_clear_tlb_entry(struct memphy_struct *mp, int pid, int pgnum)
+{
+   struct tlb_entry_struct *ent;
 
+   pthread_mutex_lock(&mp->tlb_lock);
+   if ((ent = tlb_lookup(mp, pid, pgnum)) != NULL)
+     tlb_entry_set(ent, 0, 0);
+   pthread_mutex_unlock(&mp->tlb_lock);
+   return 0;
+}
 
-int tlb_clear_tlb_entry(struct memphy_struct *mp, int pid, int pgnum)
+/*
+ *  tlb_shootdown - invalidate a page in the TLBs of all CPUs
+ *  @self: TLB of the calling CPU, invalidated at once, or NULL
+ *  @pid: process id
+ *  @pgnum: page number
+ *
+ *  The other TLBs only get a request queued, their CPU applies it at
+ *  the start of its next slot, before it runs another instruction
+ */
+int tlb_shootdown(struct memphy_struct *self, int pid, int pgnum)
 {
-   int index = pgnum % 8;
-   if (GET_PID(tlb[index][0]) == pid)
+   struct memphy_struct *mp;
+
+   if (self != NULL)
+     tlb_clear_tlb_entry(self, pid, pgnum);
+
+   for (mp = tlb_list; mp != NULL; mp = mp->tlb_next)
    {
-      CLRBIT(tlb[index][0], BIT(30));
-      SET_PID(tlb[index][0], 0);
-      tlb[index][1] = 0;
+      if (mp == self)
+        continue;
+
+      pthread_mutex_lock(&mp->tlb_sd_lock);
+      if (mp->tlb_nr_sd < TLB_SHOOTDOWN_BATCH)
+      {
+         mp->tlb_sd[mp->tlb_nr_sd].pid = pid;
+         mp->tlb_sd[mp->tlb_nr_sd].pgn = pgnum;
+      }
+      /* Past the batch size only the count grows, see the flush */
+      __atomic_store_n(&mp->tlb_nr_sd, mp->tlb_nr_sd + 1, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&mp->tlb_sd_lock);
    }
+
    return 0;
 }
-int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
+
+/*
+ *  tlb_shootdown_sync - invalidate a page in the TLBs of all CPUs now
+ *  @pid: process id
+ *  @pgnum: page number
+ *  @users: TLB hits of the process in flight, see mm_struct
+ *
+ *  For a page taken from a process running on another CPU, which cannot
+ *  wait for its next slot. Returns once no hit can use the old frame:
+ *  a hit either sees the entry gone or is waited out
+ */
+int tlb_shootdown_sync(int pid, int pgnum, int *users)
 {
-   /* TODO: the identify info is mapped to 
-    *      cache line by employing:
-    *      direct mapped, associated mapping etc.
-    */
-   int index = pgnum%8;
-   int tag = pgnum/8;
-   uint32_t tlb_pg = tlb[index][0];
-   if(tlb_pg&BIT(30)){
-      int tag_pg = GET_TAG(tlb_pg);
-      int pid_pg = GET_PID(tlb_pg);
-      if(tag==tag_pg&&pid==pid_pg){
-         *value = (int)tlb[index][1];
-         return 0 ;
-      }
-      return -1;
+   struct memphy_struct *mp;
+
+   for (mp = tlb_list; mp != NULL; mp = mp->tlb_next)
+      tlb_clear_tlb_entry(mp, pid, pgnum);
+
+   /* Pairs with the fence of tlb_hit_begin */
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   while (__atomic_load_n(users, __ATOMIC_ACQUIRE) != 0)
+      ;
+
+   return 0;
+}
+
+/*
+ *  tlb_shootdown_flush - apply the shootdowns queued for a TLB
+ *  @mp: TLB of the calling CPU
+ */
+int tlb_shootdown_flush(struct memphy_struct *mp)
+{
+   int i, nr_ent = mp->tlb_sets * mp->tlb_ways;
+
+   /* Nothing queued is the common case, skip the lock */
+   if (__atomic_load_n(&mp->tlb_nr_sd, __ATOMIC_ACQUIRE) == 0)
+     return 0;
+
+   pthread_mutex_lock(&mp->tlb_sd_lock);
+   if (mp->tlb_nr_sd > TLB_SHOOTDOWN_BATCH)
+   {
+      /* Overflowed, cheaper to start over */
+      pthread_mutex_lock(&mp->tlb_lock);
+      for (i = 0; i < nr_ent; i++)
+        if (mp->tlb_ent[i].key != 0)
+          tlb_entry_set(&mp->tlb_ent[i], 0, 0);
+      pthread_mutex_unlock(&mp->tlb_lock);
+   }
+   else
+   {
+      for (i = 0; i < mp->tlb_nr_sd; i++)
+        tlb_clear_tlb_entry(mp, mp->tlb_sd[i].pid, mp->tlb_sd[i].pgn);
    }
+   mp->tlb_nr_sd = 0;
+   pthread_mutex_unlock(&mp->tlb_sd_lock);
+
+   return 0;
+}
+
+/*
+ *  tlb_cache_read read TLB cache device
+ *  @mp: memphy struct
+ *  @pid: process id
+ *  @pgnum: page number
+ *  @fpn: obtained frame number
+ *
+ *  Lock free, a writer racing with the lookup makes it retry
+ */
+int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, int *fpn)
+{
+   struct tlb_entry_struct *set = TLB_SET(mp, pgnum);
+   uint64_t key, want = TLB_KEY(pid, pgnum);
+   uint32_t value;
+   int s = pgnum % mp->tlb_sets;
+   int way;
+
+   for (way = 0; way < mp->tlb_ways; way++)
+   {
+      tlb_entry_get(&set[way], &key, &value);
+      if (key != want)
+        continue;
+
+      /* LRU and counters are hints, relaxed updates will do */
+      __atomic_store_n(&set[way].last_use,
+                       __atomic_add_fetch(&mp->tlb_clock, 1, __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+      __atomic_fetch_add(&mp->tlb_hit[s], 1, __ATOMIC_RELAXED);
+      *fpn = value;
+      return 0;
+   }
+
+   __atomic_fetch_add(&mp->tlb_miss[s], 1, __ATOMIC_RELAXED);
    return -1;
 }
 
@@ -92,23 +240,31 @@ int tlb_cache_read(struct memphy_struct * mp, int pid, int pgnum, BYTE *value)
  *  @mp: memphy struct
  *  @pid: process id
  *  @pgnum: page number
- *  @value: obtained value
+ *  @fpn: frame number
  */
-int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, BYTE value)
+int tlb_cache_write(struct memphy_struct *mp, int pid, int pgnum, int fpn)
 {
-   /* TODO: the identify info is mapped to 
-    *      cache line by employing:
-    *      direct mapped, associated mapping etc.
-    */
+   struct tlb_entry_struct *set, *ent;
+   int way;
 
-   int index = pgnum % 8;
-   int tag = pgnum / 8;
-   tlb[index][1] = value;
-   SET_TAG(tlb[index][0], tag);
-   SET_PID(tlb[index][0], pid);
-   SETBIT(tlb[index][0], BIT(30));
+   pthread_mutex_lock(&mp->tlb_lock);
+   if ((ent = tlb_lookup(mp, pid, pgnum)) == NULL)
+   {
+      /* Take a free way, or evict the least recently used one */
+      set = TLB_SET(mp, pgnum);
+      ent = &set[0];
+      for (way = 0; way < mp->tlb_ways && ent->key != 0; way++)
+        if (set[way].key == 0 || set[way].last_use < ent->last_use)
+          ent = &set[way];
+   }
 
-   return -1;
+   tlb_entry_set(ent, TLB_KEY(pid, pgnum), fpn);
+   __atomic_store_n(&ent->last_use,
+                    __atomic_add_fetch(&mp->tlb_clock, 1, __ATOMIC_RELAXED),
+                    __ATOMIC_RELAXED);
+   pthread_mutex_unlock(&mp->tlb_lock);
+
+   return 0;
 }
 
 /*
@@ -157,38 +313,62 @@ int TLBMEMPHY_dump(struct memphy_struct * mp)
    /*TODO dump memphy contnt mp->storage 
     *     for tracing the memory content
     */
+   int i, nr_ent = mp->tlb_sets * mp->tlb_ways;
+   uint64_t *key = malloc(nr_ent * sizeof(uint64_t));
+   uint32_t *value = malloc(nr_ent * sizeof(uint32_t));
+
+   /* Snapshot first, lookups go on meanwhile and printing is slow */
+   for (i = 0; i < nr_ent; i++)
+      tlb_entry_get(&mp->tlb_ent[i], &key[i], &value[i]);
 
-  pthread_mutex_lock(&tlb_lock);
    printf("-----------------------Dump TLB------------------------\n");
-   for (int i = 0; i < MAX_TLB; i++)
+   for (i = 0; i < nr_ent; i++)
    {
-      int valid = GET_VALID(tlb[i][0]);
-      int pid = GET_PID(tlb[i][0]);
-      int frame = tlb[i][1];
-      printf("%02d %d %08d %08d\n", i, valid, pid, frame);
+      int valid = (key[i] & TLB_KEY_VALID) != 0;
+      printf("%02d %d %08d %08d\n", i, valid, TLB_KEY_PID(key[i]), (int)value[i]);
    }
+   for (i = 0; i < mp->tlb_sets; i++)
+      printf("set %02d: %lu hits %lu misses\n", i,
+             __atomic_load_n(&mp->tlb_hit[i], __ATOMIC_RELAXED),
+             __atomic_load_n(&mp->tlb_miss[i], __ATOMIC_RELAXED));
    printf("-----------------------Dump TLB------------------------\n");
-   pthread_mutex_unlock(&tlb_lock);
+   free(key);
+   free(value);
    return 0;
 }
 
 
 /*
  *  Init TLBMEMPHY struct
+ *  @max_size: number of entries
+ *  @ways: associativity, 1 is direct mapped and max_size fully associative
  */
-int init_tlbmemphy(struct memphy_struct *mp, int max_size)
+int init_tlbmemphy(struct memphy_struct *mp, int max_size, int ways)
 {
-   mp->storage = (BYTE *)malloc(max_size*sizeof(BYTE));
-   for (int i = 0; i < MAX_TLB; i++)
-   {
-      tlb[i] = (uint32_t *)(mp->storage + i * 8);
-      tlb[i][0] = 0; 
-      tlb[i][1] = 0;
-   }
-   mp->maxsz = max_size;
+   if (max_size < 1)
+     max_size = 1;
+   if (ways < 1 || ways > max_size)
+     ways = (ways < 1) ? 1 : max_size;
+
+   mp->tlb_ways = ways;
+   mp->tlb_sets = max_size / ways;
+   mp->tlb_clock = 0;
+   mp->tlb_ent = calloc(mp->tlb_sets * ways, sizeof(struct tlb_entry_struct));
+   mp->tlb_hit = calloc(mp->tlb_sets, sizeof(unsigned long));
+   mp->tlb_miss = calloc(mp->tlb_sets, sizeof(unsigned long));
+
+   /* Native device access sees the raw entries */
+   mp->storage = (BYTE *)mp->tlb_ent;
+   mp->maxsz = mp->tlb_sets * ways * sizeof(struct tlb_entry_struct);
 
    mp->rdmflg = 1;
-   pthread_mutex_init(&tlb_lock, NULL);
+   pthread_mutex_init(&mp->tlb_lock, NULL);
+
+   pthread_mutex_init(&mp->tlb_sd_lock, NULL);
+   mp->tlb_sd = malloc(TLB_SHOOTDOWN_BATCH * sizeof(struct tlb_shootdown_struct));
+   mp->tlb_nr_sd = 0;
+   mp->tlb_next = tlb_list;
+   tlb_list = mp;
    return 0;
 }
 
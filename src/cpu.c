@@ -2,6 +2,7 @@
 #include "cpu.h"
 #include "mem.h"
 #include "mm.h"
+#include <stdlib.h>
 
 int calc(struct pcb_t * proc) {
 	return ((unsigned long)proc & 0UL);
@@ -45,60 +46,140 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 } 
 
-int run(struct pcb_t * proc) {
-	/* Check if Program Counter point to the proper instruction */
-	if (proc->pc >= proc->code->size) {
-		return 1;
-	}
-	
-	struct inst_t ins = proc->code->text[proc->pc];
-	proc->pc++;
-	int stat = 1;
-	switch (ins.opcode) {
-	case CALC:
-		stat = calc(proc);
-		break;
-	case ALLOC:
+/* Handlers of the decoded instructions, the memory backend is bound
+ * here instead of being selected at every instruction */
+static int op_calc(struct pcb_t * proc, const struct dinst_t * ins) {
+	return calc(proc);
+}
+
+static int op_alloc(struct pcb_t * proc, const struct dinst_t * ins) {
 #ifdef CPU_TLB 
-		stat = tlballoc(proc, ins.arg_0, ins.arg_1);
+	return tlballoc(proc, ins->arg_0, ins->arg_1);
 #elif defined(MM_PAGING)
-		stat = pgalloc(proc, ins.arg_0, ins.arg_1);
+	return pgalloc(proc, ins->arg_0, ins->arg_1);
 #else
-		stat = alloc(proc, ins.arg_0, ins.arg_1);
+	return alloc(proc, ins->arg_0, ins->arg_1);
 #endif
-		break;
-	case FREE:
+}
+
+static int op_free(struct pcb_t * proc, const struct dinst_t * ins) {
 #ifdef CPU_TLB
-		stat = tlbfree_data(proc, ins.arg_0);
+	return tlbfree_data(proc, ins->arg_0);
 #elif defined(MM_PAGING)
-		stat = pgfree_data(proc, ins.arg_0);
+	return pgfree_data(proc, ins->arg_0);
 #else
-		stat = free_data(proc, ins.arg_0);
+	return free_data(proc, ins->arg_0);
 #endif
-		break;
-	case READ:
+}
+
+static int op_read(struct pcb_t * proc, const struct dinst_t * ins) {
 #ifdef CPU_TLB
-		stat = tlbread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return tlbread(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #elif defined(MM_PAGING)
-		stat = pgread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return pgread(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #else
-		stat = read(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return read(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #endif
-		break;
-	case WRITE:
+}
+
+static int op_write(struct pcb_t * proc, const struct dinst_t * ins) {
 #ifdef CPU_TLB
-		stat = tlbwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return tlbwrite(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #elif defined(MM_PAGING)
-		stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return pgwrite(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #else
-		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	return write(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+#endif
+}
+
+static int op_invalid(struct pcb_t * proc, const struct dinst_t * ins) {
+	return 1;
+}
+
+static const inst_handler_t op_handlers[] = {
+	[CALC]	= op_calc,
+	[ALLOC]	= op_alloc,
+	[FREE]	= op_free,
+	[READ]	= op_read,
+	[WRITE]	= op_write,
+};
+
+int decode(struct code_seg_t * code) {
+	struct dinst_t * dtext, * none = NULL;
+	uint32_t i;
+
+	if (__atomic_load_n(&code->dtext, __ATOMIC_ACQUIRE) != NULL) {
+		return 0;
+	}
+
+	dtext = (struct dinst_t*)malloc(sizeof(struct dinst_t) * code->size);
+	if (dtext == NULL) {
+		return 1;
+	}
+	for (i = code->size; i-- > 0; ) {
+		unsigned op = code->text[i].opcode;
+
+		dtext[i].handler = op < sizeof(op_handlers) / sizeof(op_handlers[0]) ?
+			op_handlers[op] : op_invalid;
+		dtext[i].arg_0 = code->text[i].arg_0;
+		dtext[i].arg_1 = code->text[i].arg_1;
+		dtext[i].arg_2 = code->text[i].arg_2;
+		/* Run-length of the CALCs, see calc_run() */
+		dtext[i].calc_run = op != CALC ? 0 :
+			(i + 1 < code->size ? dtext[i + 1].calc_run : 0) + 1;
+	}
+
+	/* Lost a race on a shared segment, use the winner's */
+	if (!__atomic_compare_exchange_n(&code->dtext, &none, dtext, 0,
+			__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		free(dtext);
+	}
+	return 0;
+}
+
+int run_slice(struct pcb_t * proc, uint32_t n) {
+	const struct dinst_t * dtext = proc->code->dtext;
+	uint32_t end = proc->pc + n;
+	int stat = 1;
+
+	if (dtext == NULL) {
+		if (decode(proc->code) != 0) {
+			return 1;
+		}
+		dtext = proc->code->dtext;
+	}
+	if (end > proc->code->size || end < proc->pc) {
+		end = proc->code->size;
+	}
+	while (proc->pc < end) {
+		const struct dinst_t * ins = &dtext[proc->pc++];
+#ifdef CPU_TLB
+		/* Shootdowns queued since the slot began, our own reclaims
+		 * included, must not leave a memory access a stale entry */
+		if (ins->calc_run == 0) {
+			tlb_shootdown_flush(proc->tlb);
+		}
 #endif
-		break;
-	default:
-		stat = 1;
+		stat = ins->handler(proc, ins);
 	}
 	return stat;
+}
 
+uint32_t calc_run(struct pcb_t * proc) {
+	if (proc->pc >= proc->code->size) {
+		return 0;
+	}
+	if (proc->code->dtext == NULL && decode(proc->code) != 0) {
+		return 0;
+	}
+	return proc->code->dtext[proc->pc].calc_run;
 }
 
+int run(struct pcb_t * proc) {
+	/* Check if Program Counter point to the proper instruction */
+	if (proc->pc >= proc->code->size) {
+		return 1;
+	}
+	return run_slice(proc, 1);
+}
 
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static uint32_t avail_pid = 1;
 
@@ -29,54 +31,94 @@ static enum ins_opcode_t get_opcode(char * opt) {
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
+/* Programs in use, processes running the same program file share
+ * one immutable code segment */
+struct prog_cache_t {
+	char * path;
+	struct timespec mtime;	// A rewritten file is another program
+	uint32_t priority;
+	struct code_seg_t * code;
+	int refs;		// Processes using the code
+	struct prog_cache_t * next;
+};
 
-	/* Read process code from file */
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find process description at '%s'\n", path);
-		exit(1);		
+static struct prog_cache_t * prog_cache = NULL;
+static pthread_mutex_t prog_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Map a compiled program, its text is used in place */
+static void load_compiled(FILE * file, const char * path,
+		struct prog_hdr_t * hdr, struct code_seg_t * code,
+		uint32_t * priority) {
+	struct stat st;
+	void * map;
+
+	if (hdr->version != PROG_VERSION ||
+			hdr->inst_size != sizeof(struct inst_t)) {
+		printf("Incompatible compiled program '%s'\n", path);
+		exit(1);
 	}
+	if (fstat(fileno(file), &st) != 0 || (size_t)st.st_size <
+			sizeof(*hdr) + (size_t)hdr->size * sizeof(struct inst_t)) {
+		printf("Truncated compiled program '%s'\n", path);
+		exit(1);
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (map == MAP_FAILED) {
+		printf("Cannot map compiled program '%s'\n", path);
+		exit(1);
+	}
+
+	*priority = hdr->priority;
+	code->size = hdr->size;
+	code->text = (struct inst_t *)((char *)map + sizeof(*hdr));
+	code->map_sz = st.st_size;
+}
+
+/* Read the code of a program file, compiled or process description */
+static struct code_seg_t * read_code(FILE * file, const char * path,
+		uint32_t * priority) {
 	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
-	proc->code->text = (struct inst_t*)malloc(
-		sizeof(struct inst_t) * proc->code->size
+	struct code_seg_t * code =
+		(struct code_seg_t*)malloc(sizeof(struct code_seg_t));
+	code->map_sz = 0;
+	code->dtext = NULL;
+
+	struct prog_hdr_t hdr;
+	if (fread(&hdr, sizeof(hdr), 1, file) == 1 && hdr.magic == PROG_MAGIC) {
+		load_compiled(file, path, &hdr, code, priority);
+		return code;
+	}
+	rewind(file);
+	fscanf(file, "%u %u", priority, &code->size);
+	code->text = (struct inst_t*)malloc(
+		sizeof(struct inst_t) * code->size
 	);
 	uint32_t i = 0;
-	for (i = 0; i < proc->code->size; i++) {
+	for (i = 0; i < code->size; i++) {
 		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+		code->text[i].opcode = get_opcode(opcode);
+		switch(code->text[i].opcode) {
 		case CALC:
 			break;
 		case ALLOC:
 			fscanf(
 				file,
 				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
+				&code->text[i].arg_0,
+				&code->text[i].arg_1
 			);
 			break;
 		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			fscanf(file, "%u\n", &code->text[i].arg_0);
 			break;
 		case READ:
 		case WRITE:
 			fscanf(
 				file,
 				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2
 			);
 			break;	
 		default:
@@ -84,8 +126,118 @@ struct pcb_t * load(const char * path) {
 			exit(1);
 		}
 	}
+	return code;
+}
+
+static void free_code(struct code_seg_t * code) {
+	if (code->map_sz) {
+		munmap((char *)code->text - sizeof(struct prog_hdr_t),
+			code->map_sz);
+	}else{
+		free(code->text);
+	}
+	free(code->dtext);
+	free(code);
+}
+
+/* Find a program in the cache and take a reference, prog_cache_lock held */
+static struct prog_cache_t * prog_cache_get(const char * path,
+		struct timespec * mtime) {
+	struct prog_cache_t * prog;
+
+	for (prog = prog_cache; prog != NULL; prog = prog->next) {
+		if (prog->mtime.tv_sec == mtime->tv_sec &&
+				prog->mtime.tv_nsec == mtime->tv_nsec &&
+				!strcmp(prog->path, path)) {
+			prog->refs++;
+			return prog;
+		}
+	}
+	return NULL;
+}
+
+struct pcb_t * load(const char * path) {
+	/* Create new PCB for the new process */
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+	proc->pid = 0;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+
+	/* Read process code from file */
+	FILE * file;
+	if ((file = fopen(path, "r")) == NULL) {
+		printf("Cannot find process description at '%s'\n", path);
+		exit(1);		
+	}
+
+	/* Share the code of a process already running the program */
+	struct stat st;
+	struct prog_cache_t * prog;
+	fstat(fileno(file), &st);
+	pthread_mutex_lock(&prog_cache_lock);
+	prog = prog_cache_get(path, &st.st_mtim);
+	pthread_mutex_unlock(&prog_cache_lock);
+
+	if (prog == NULL) {
+		/* Read it unlocked, then publish unless another load won */
+		uint32_t priority;
+		struct code_seg_t * code = read_code(file, path, &priority);
+
+		pthread_mutex_lock(&prog_cache_lock);
+		prog = prog_cache_get(path, &st.st_mtim);
+		if (prog == NULL) {
+			prog = (struct prog_cache_t*)malloc(sizeof(struct prog_cache_t));
+			prog->path = strdup(path);
+			prog->mtime = st.st_mtim;
+			prog->priority = priority;
+			prog->code = code;
+			prog->refs = 1;
+			prog->next = prog_cache;
+			prog_cache = prog;
+			code = NULL;
+		}
+		pthread_mutex_unlock(&prog_cache_lock);
+		if (code != NULL) {
+			free_code(code);
+		}
+	}
+	fclose(file);
+
+	proc->priority = prog->priority;
+	proc->code = prog->code;
 	return proc;
 }
 
+void assign_pid(struct pcb_t * proc) {
+	proc->pid = avail_pid;
+	avail_pid++;
+}
+
+void unload(struct pcb_t * proc) {
+	struct prog_cache_t ** link, * prog = NULL;
 
+	/* Drop the reference on the code, the last user frees it */
+	pthread_mutex_lock(&prog_cache_lock);
+	for (link = &prog_cache; *link != NULL; link = &(*link)->next) {
+		if ((*link)->code == proc->code) {
+			prog = *link;
+			if (--prog->refs == 0) {
+				*link = prog->next;
+			}else{
+				prog = NULL;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&prog_cache_lock);
 
+	if (prog != NULL) {
+		free_code(prog->code);
+		free(prog->path);
+		free(prog);
+	}
+	free(proc->page_table);
+	free(proc);
+}
@@ -7,26 +7,54 @@
 #include "mm.h"
 #include <stdlib.h>
 #include<stdio.h>
+#include <string.h>
+
+/* Seek time spent by this thread and not charged to the clock yet */
+static __thread uint64_t seek_pending;
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  The cursor jumps straight to @offset, the travelled distance is
+ *  turned into seek time: counted on the device, and owed by the
+ *  calling thread until MEMPHY_seek_slots charges it
  */
 int MEMPHY_mv_csr(struct memphy_struct *mp, int offset)
 {
-   int numstep = 0;
+   int dist, cost;
 
-   mp->cursor = 0;
-   while(numstep < offset && numstep < mp->maxsz){
-     /* Traverse sequentially */
-     mp->cursor = (mp->cursor + 1) % mp->maxsz;
-     numstep++;
-   }
+   if (offset < 0 || offset >= mp->maxsz)
+     return -1;
+
+   dist = (offset > mp->cursor) ? offset - mp->cursor : mp->cursor - offset;
+   if (dist == 0)
+     return 0;
+
+   cost = MEMPHY_SEEK_LATENCY + dist / MEMPHY_SEEK_RATE;
+   mp->seek_cnt++;
+   mp->seek_dist += dist;
+   mp->seek_time += cost;
+   seek_pending += cost;
+   mp->cursor = offset;
 
    return 0;
 }
 
+/*
+ *  MEMPHY_seek_slots - time slots the seeks of the calling thread took
+ *  since the last call, at MEMPHY_SEEK_SLOT_TIME per slot. Less than a
+ *  slot is carried over to the next call
+ */
+int MEMPHY_seek_slots(void)
+{
+   int slots = seek_pending / MEMPHY_SEEK_SLOT_TIME;
+
+   seek_pending %= MEMPHY_SEEK_SLOT_TIME;
+   return slots;
+}
+
 /*
  *  MEMPHY_seq_read - read MEMPHY device
  *  @mp: memphy struct
@@ -38,7 +66,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
    if (mp == NULL)
      return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
      return -1; /* Not compatible mode for sequential read */
 
    MEMPHY_mv_csr(mp, addr);
@@ -78,7 +106,7 @@ int MEMPHY_seq_write(struct memphy_struct * mp, int addr, BYTE value)
    if (mp == NULL)
      return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
      return -1; /* Not compatible mode for sequential read */
 
    MEMPHY_mv_csr(mp, addr);
@@ -106,6 +134,54 @@ int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data)
    return 0;
 }
 
+/*
+ *  MEMPHY_read_frame - read a whole frame of MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: PAGING_PAGESZ bytes of obtained data
+ *
+ *  Sequential devices seek once to the frame then stream it out
+ */
+int MEMPHY_read_frame(struct memphy_struct *mp, int fpn, BYTE *buf)
+{
+   int addr = fpn * PAGING_PAGESZ;
+
+   if (mp == NULL || fpn < 0 || addr + PAGING_PAGESZ > mp->maxsz)
+     return -1;
+
+   if (!mp->rdmflg)
+   {
+      MEMPHY_mv_csr(mp, addr);
+      mp->cursor = (mp->cursor + PAGING_PAGESZ) % mp->maxsz;
+   }
+   memcpy(buf, mp->storage + addr, PAGING_PAGESZ);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_frame - write a whole frame of MEMPHY device
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: PAGING_PAGESZ bytes of written data
+ */
+int MEMPHY_write_frame(struct memphy_struct *mp, int fpn, const BYTE *buf)
+{
+   int addr = fpn * PAGING_PAGESZ;
+
+   if (mp == NULL || fpn < 0 || addr + PAGING_PAGESZ > mp->maxsz)
+     return -1;
+
+   if (!mp->rdmflg)
+   {
+      MEMPHY_mv_csr(mp, addr);
+      mp->cursor = (mp->cursor + PAGING_PAGESZ) % mp->maxsz;
+   }
+   memcpy(mp->storage + addr, buf, PAGING_PAGESZ);
+
+   return 0;
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
@@ -114,47 +190,84 @@ int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
     /* This setting come with fixed constant PAGESZ */
     int numfp = mp->maxsz / pagesz;
-    struct framephy_struct *newfst, *fst;
-    int iter = 0;
+    int iter;
+
+    pthread_mutex_init(&mp->fp_lock, NULL);
+    mp->free_fp_stack = NULL;
+    mp->free_fp_top = 0;
+    mp->numfp = 0;
+    mp->fp_tbl = NULL;
 
     if (numfp <= 0)
       return -1;
 
-    /* Init head of free framephy list */ 
-    fst = malloc(sizeof(struct framephy_struct));
-    fst->fpn = iter;
-    mp->free_fp_list = fst;
+    mp->free_fp_stack = malloc(numfp * sizeof(int));
+    mp->fp_tbl = calloc(numfp, sizeof(struct framephy_struct));
+    mp->numfp = numfp;
 
-    /* We have list with first element, fill in the rest num-1 element member*/
-    for (iter = 1; iter < numfp ; iter++)
+    /* Stack the frames so that they are handed out from frame 0 up */
+    for (iter = 0; iter < numfp; iter++)
     {
-       newfst =  malloc(sizeof(struct framephy_struct));
-       newfst->fpn = iter;
-       newfst->fp_next = NULL;
-       fst->fp_next = newfst;
-       fst = newfst;
+       mp->free_fp_stack[iter] = numfp - 1 - iter;
+       mp->fp_tbl[iter].fpn = iter;
     }
+    mp->free_fp_top = numfp;
 
     return 0;
 }
 
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-
-   if (fp == NULL)
+   pthread_mutex_lock(&mp->fp_lock);
+   if (mp->free_fp_top == 0)
+   {
+     pthread_mutex_unlock(&mp->fp_lock);
      return -1;
+   }
 
-   *retfpn = fp->fpn;
-   mp->free_fp_list = fp->fp_next;
+   *retfpn = mp->free_fp_stack[--mp->free_fp_top];
+   pthread_mutex_unlock(&mp->fp_lock);
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
-   free(fp);
    return 0;
 }
 
+/*
+ *  MEMPHY_get_freefp_n - get up to @n free frames at once
+ *  @mp: memphy struct
+ *  @n: number of wanted frames
+ *  @retfpn: returned frames, in the order MEMPHY_get_freefp gives them
+ *
+ *  Return the number of obtained frames
+ */
+int MEMPHY_get_freefp_n(struct memphy_struct *mp, int n, int *retfpn)
+{
+   int got, iter;
+
+   pthread_mutex_lock(&mp->fp_lock);
+   got = (n < mp->free_fp_top) ? n : mp->free_fp_top;
+   for (iter = 0; iter < got; iter++)
+     retfpn[iter] = mp->free_fp_stack[mp->free_fp_top - 1 - iter];
+   mp->free_fp_top -= got;
+   pthread_mutex_unlock(&mp->fp_lock);
+
+   return got;
+}
+
+/*
+ *  MEMPHY_nr_freefp - number of free frames
+ *  @mp: memphy struct
+ */
+int MEMPHY_nr_freefp(struct memphy_struct *mp)
+{
+   int nr;
+
+   pthread_mutex_lock(&mp->fp_lock);
+   nr = mp->free_fp_top;
+   pthread_mutex_unlock(&mp->fp_lock);
+
+   return nr;
+}
+
 int MEMPHY_dump(struct memphy_struct * mp)
 {
     /*TODO dump memphy contnt mp->storage 
@@ -170,15 +283,35 @@ int MEMPHY_dump(struct memphy_struct * mp)
    return 0;
 }
 
+/*
+ *  MEMPHY_seek_stats - report the seek cost of a sequential device
+ *  @mp: memphy struct
+ *  @name: device name shown in the report
+ */
+int MEMPHY_seek_stats(struct memphy_struct *mp, const char *name)
+{
+   if (mp == NULL || mp->rdmflg)
+     return -1;
+
+   printf("%s: %llu seeks, %llu bytes travelled, %llu time units\n", name,
+          (unsigned long long)mp->seek_cnt,
+          (unsigned long long)mp->seek_dist,
+          (unsigned long long)mp->seek_time);
+
+   return 0;
+}
+
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   pthread_mutex_lock(&mp->fp_lock);
+   if (fpn < 0 || fpn >= mp->numfp || mp->free_fp_top == mp->numfp)
+   {
+     pthread_mutex_unlock(&mp->fp_lock);
+     return -1;
+   }
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->fp_next = fp;
-   mp->free_fp_list = newnode;
+   mp->free_fp_stack[mp->free_fp_top++] = fpn;
+   pthread_mutex_unlock(&mp->fp_lock);
 
    return 0;
 }
@@ -196,8 +329,13 @@ int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
 
    mp->rdmflg = (randomflg != 0)?1:0;
 
-   if (!mp->rdmflg )   /* Not Ramdom acess device, then it serial device*/
-      mp->cursor = 0;
+   /* Not Ramdom acess device, then it serial device*/
+   mp->cursor = 0;
+   mp->seek_cnt = mp->seek_dist = mp->seek_time = 0;
+
+   mp->active_head = mp->active_tail = NULL;
+   mp->inactive_head = mp->inactive_tail = NULL;
+   mp->nr_active = mp->nr_inactive = 0;
 
    return 0;
 }
@@ -0,0 +1,403 @@
+//#ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Page replacement policy module mm/mm-policy.c
+ *
+ * Every policy works on the FIFO of resident pages of an mm (see
+ * enlist_fifo_frame), the clock based ones use its head as the hand
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Fault and swap traffic counters, shown by pgrep_report */
+static unsigned long nr_faults;
+static unsigned long nr_swpout;
+static unsigned long nr_swpin;
+static unsigned long nr_fault_free;
+static unsigned long nr_bg_swpout;
+
+/*
+ * fp_test_and_clear_accessed - consume the accessed bit of a frame's PTE
+ * @fp : frame table entry of a resident page
+ */
+static int fp_test_and_clear_accessed(struct framephy_struct *fp)
+{
+  uint32_t *pte = pte_lookup(fp->owner, fp->pgn);
+
+  /* Atomic, global reclaim may age frames of an mm it does not lock */
+  return (__atomic_fetch_and(pte, ~PAGING_PTE_ACCESSED_MASK, __ATOMIC_RELAXED) &
+          PAGING_PTE_ACCESSED_MASK) != 0;
+}
+
+/*
+ * clock_advance - move the clock hand, i.e. rotate the head to the tail
+ * @mm : mm owning the FIFO
+ */
+static void clock_advance(struct mm_struct *mm)
+{
+  struct framephy_struct *fp = mm->fifo_head;
+
+  if (fp == NULL || fp == mm->fifo_tail)
+    return;
+
+  mm->fifo_head = fp->fp_next;
+  mm->fifo_head->fp_prev = NULL;
+
+  fp->fp_prev = mm->fifo_tail;
+  fp->fp_next = NULL;
+  mm->fifo_tail->fp_next = fp;
+  mm->fifo_tail = fp;
+}
+
+/*
+ * take_victim - delist the chosen frame and return its page
+ */
+static int take_victim(struct mm_struct *mm, struct framephy_struct *fp, int *retpgn)
+{
+  *retpgn = fp->pgn;
+  delist_fifo_frame(mm, fp);
+
+  return 0;
+}
+
+/* FIFO - the oldest resident page */
+static int fifo_victim(struct mm_struct *mm, int *retpgn)
+{
+  if (mm->fifo_head == NULL)
+    return -1;
+
+  return take_victim(mm, mm->fifo_head, retpgn);
+}
+
+/* CLOCK - second chance to pages accessed since the hand last passed */
+static int clock_victim(struct mm_struct *mm, int *retpgn)
+{
+  if (mm->fifo_head == NULL)
+    return -1;
+
+  /* Ends within two rounds, the first one clears every accessed bit */
+  while (fp_test_and_clear_accessed(mm->fifo_head))
+    clock_advance(mm);
+
+  return take_victim(mm, mm->fifo_head, retpgn);
+}
+
+/* LRU approximation - aging counters shifted in with the accessed bit */
+static int lru_victim(struct mm_struct *mm, int *retpgn)
+{
+  struct framephy_struct *fp, *vic = NULL;
+
+  for (fp = mm->fifo_head; fp != NULL; fp = fp->fp_next)
+  {
+    fp->age = (fp->age >> 1) |
+              ((uint32_t)fp_test_and_clear_accessed(fp) << 31);
+
+    /* Oldest page first among equal ages */
+    if (vic == NULL || fp->age < vic->age)
+      vic = fp;
+  }
+
+  if (vic == NULL)
+    return -1;
+
+  return take_victim(mm, vic, retpgn);
+}
+
+/* WSClock - evict a page out of the working set window of the mm */
+static int wsclock_victim(struct mm_struct *mm, int *retpgn)
+{
+  struct framephy_struct *fp, *start, *vic = NULL;
+
+  start = mm->fifo_head;
+  if (start == NULL)
+    return -1;
+
+  do {
+    fp = mm->fifo_head;
+
+    if (fp_test_and_clear_accessed(fp))
+      fp->last_use = mm->vtime;
+    else if (mm->vtime - fp->last_use > PAGING_WSCLOCK_TAU)
+      return take_victim(mm, fp, retpgn);
+    else if (vic == NULL || fp->last_use < vic->last_use)
+      vic = fp;
+
+    clock_advance(mm);
+  } while (mm->fifo_head != start);
+
+  /* The whole resident set is in use, take the least recently used */
+  if (vic == NULL)
+    vic = mm->fifo_head;
+
+  return take_victim(mm, vic, retpgn);
+}
+
+static struct pgrep_policy pgrep_policies[] = {
+  { "fifo",    fifo_victim },
+  { "clock",   clock_victim },
+  { "lru",     lru_victim },
+  { "wsclock", wsclock_victim },
+};
+
+struct pgrep_policy *pgrep = &pgrep_policies[0];
+
+/*
+ * pgrep_select - choose the page replacement policy by name
+ * @name : fifo, clock, lru or wsclock
+ */
+int pgrep_select(const char *name)
+{
+  int i;
+
+  for (i = 0; i < sizeof(pgrep_policies) / sizeof(pgrep_policies[0]); i++)
+  {
+    if (strcmp(pgrep_policies[i].name, name) == 0)
+    {
+      pgrep = &pgrep_policies[i];
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * pgrep_account - count a page fault or a page moved to/from swap
+ */
+void pgrep_account(int fault, int swpout, int swpin)
+{
+  __atomic_fetch_add(&nr_faults, fault, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&nr_swpout, swpout, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&nr_swpin, swpin, __ATOMIC_RELAXED);
+}
+
+/*
+ * pgrep_account_bg - count a fault served by a free frame or pages
+ *                    evicted in background
+ */
+void pgrep_account_bg(int fault_free, int bg_swpout)
+{
+  __atomic_fetch_add(&nr_fault_free, fault_free, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&nr_bg_swpout, bg_swpout, __ATOMIC_RELAXED);
+}
+
+int pgrep_report(void)
+{
+#ifdef MM_GLOBAL_RECLAIM
+  const char *name = "global";
+#else
+  const char *name = pgrep->name;
+#endif
+
+  printf("Page replacement %s: %lu faults, swapped out %lu pages, swapped in %lu pages\n",
+         name, nr_faults, nr_swpout, nr_swpin);
+#ifdef MM_KSWAPD
+  printf("kswapd: swapped out %lu pages, %lu of %lu faults found a free frame\n",
+         nr_bg_swpout, nr_fault_free, nr_faults);
+#endif
+
+  return 0;
+}
+
+/*
+ * Global reclaim keeps every resident frame of a RAM device on one of
+ * two lists, whatever process owns it. Frames enter the inactive list,
+ * an accessed inactive frame is promoted and the active list is aged
+ * into the inactive one to keep them balanced. The victim is the first
+ * unreferenced frame of the inactive list.
+ */
+
+/* Protects the lists and the owner of the frames on them */
+static pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Longest wait, in us, before looking again at frames whose owners
+ * were all busy */
+#define LRU_RECLAIM_MAX_BACKOFF 1024
+
+static void fp_list_add_tail(struct framephy_struct **head,
+                             struct framephy_struct **tail,
+                             struct framephy_struct *fp)
+{
+  fp->fp_next = NULL;
+  fp->fp_prev = *tail;
+  if (*tail != NULL)
+    (*tail)->fp_next = fp;
+  else
+    *head = fp;
+  *tail = fp;
+}
+
+static void fp_list_del(struct framephy_struct **head,
+                        struct framephy_struct **tail,
+                        struct framephy_struct *fp)
+{
+  if (fp->fp_prev != NULL)
+    fp->fp_prev->fp_next = fp->fp_next;
+  else
+    *head = fp->fp_next;
+  if (fp->fp_next != NULL)
+    fp->fp_next->fp_prev = fp->fp_prev;
+  else
+    *tail = fp->fp_prev;
+  fp->fp_next = fp->fp_prev = NULL;
+}
+
+static void lru_move(struct memphy_struct *mp, struct framephy_struct *fp, int active)
+{
+  if (fp->active)
+  {
+    fp_list_del(&mp->active_head, &mp->active_tail, fp);
+    mp->nr_active--;
+  }
+  else
+  {
+    fp_list_del(&mp->inactive_head, &mp->inactive_tail, fp);
+    mp->nr_inactive--;
+  }
+
+  fp->active = active;
+  if (active)
+  {
+    fp_list_add_tail(&mp->active_head, &mp->active_tail, fp);
+    mp->nr_active++;
+  }
+  else
+  {
+    fp_list_add_tail(&mp->inactive_head, &mp->inactive_tail, fp);
+    mp->nr_inactive++;
+  }
+}
+
+/*
+ * lru_add_frame - put a newly mapped frame on the inactive list
+ * @mp : RAM device
+ * @fp : frame table entry, owner and pgn already set
+ */
+int lru_add_frame(struct memphy_struct *mp, struct framephy_struct *fp)
+{
+  pthread_mutex_lock(&lru_lock);
+  fp->active = 0;
+  fp_list_add_tail(&mp->inactive_head, &mp->inactive_tail, fp);
+  mp->nr_inactive++;
+  pthread_mutex_unlock(&lru_lock);
+
+  return 0;
+}
+
+/*
+ * lru_del_frame - take an unmapped frame off the reclaim lists
+ * @mp : RAM device
+ * @fp : frame table entry
+ */
+int lru_del_frame(struct memphy_struct *mp, struct framephy_struct *fp)
+{
+  pthread_mutex_lock(&lru_lock);
+  if (fp->owner == NULL)
+  {
+    pthread_mutex_unlock(&lru_lock);
+    return -1; /* not enlisted */
+  }
+
+  if (fp->active)
+  {
+    fp_list_del(&mp->active_head, &mp->active_tail, fp);
+    mp->nr_active--;
+  }
+  else
+  {
+    fp_list_del(&mp->inactive_head, &mp->inactive_tail, fp);
+    mp->nr_inactive--;
+  }
+  fp->owner = NULL;
+  pthread_mutex_unlock(&lru_lock);
+
+  return 0;
+}
+
+/*
+ * lru_reclaim - pick and delist the coldest frame of the RAM
+ * @mp     : RAM device
+ * @self   : mm already locked by the caller, or NULL
+ * @retmm  : return the owner mm of the victim page, locked if not @self
+ * @retpgn : return the victim page number in its owner
+ *
+ * The owner of a frame is only trylocked, the caller holds @self and
+ * blocking on another mm could deadlock. Frames of a busy owner are
+ * passed over; when a whole lap found nothing to take, the lists are
+ * released and scanned again after a backoff. A busy owner is in the
+ * middle of a memory access and will let its lock go, a faulting one
+ * can always evict its own frames, so this only fails when no frame is
+ * on the lists at all. An owner running on another CPU is fine, the
+ * caller shoots the page down synchronously (see swap_out_page)
+ *
+ * Without @self the caller is kswapd, the reclaim is in background and
+ * only takes a cold frame: accessed active frames are rotated instead
+ * of aged, and after looking at each frame twice without finding one
+ * it fails rather than waiting or evicting a hot page
+ */
+int lru_reclaim(struct memphy_struct *mp, struct mm_struct *self,
+                struct mm_struct **retmm, int *retpgn)
+{
+  struct framephy_struct *fp;
+  int skipped = 0, backoff = 1, scan;
+
+  pthread_mutex_lock(&lru_lock);
+  scan = 2 * (mp->nr_active + mp->nr_inactive);
+  for (;;)
+  {
+    if ((mp->inactive_head == NULL && mp->active_head == NULL) ||
+        (self == NULL && scan-- == 0))
+    {
+      pthread_mutex_unlock(&lru_lock);
+      return -1;
+    }
+
+    /* Age the head of the active list into the inactive one */
+    if (mp->active_head != NULL &&
+        (mp->inactive_head == NULL || mp->nr_inactive < mp->nr_active))
+    {
+      fp = mp->active_head;
+      lru_move(mp, fp, fp_test_and_clear_accessed(fp) && self == NULL);
+      continue;
+    }
+
+    fp = mp->inactive_head;
+    if (fp_test_and_clear_accessed(fp))
+    {
+      lru_move(mp, fp, 1);
+      continue;
+    }
+
+    if (fp->owner == self)
+      break;
+    if (pthread_mutex_trylock(&fp->owner->lock) == 0)
+      break;
+
+    /* Owner busy, try the next one */
+    lru_move(mp, fp, 0);
+    if (self != NULL && ++skipped > mp->nr_active + mp->nr_inactive)
+    {
+      /* Every owner busy, wait for them without holding the lists */
+      pthread_mutex_unlock(&lru_lock);
+      usleep(backoff);
+      if (backoff < LRU_RECLAIM_MAX_BACKOFF)
+        backoff <<= 1;
+      skipped = 0;
+      pthread_mutex_lock(&lru_lock);
+    }
+  }
+
+  fp_list_del(&mp->inactive_head, &mp->inactive_tail, fp);
+  mp->nr_inactive--;
+  *retmm = fp->owner;
+  *retpgn = fp->pgn;
+  fp->owner = NULL;
+  pthread_mutex_unlock(&lru_lock);
+
+  return 0;
+}
+
+//#endif
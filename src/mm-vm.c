@@ -10,7 +10,21 @@
 #include <stdio.h>
 #include <pthread.h>
 
-static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Locking: mm->lock guards the page table, the regions and the resident
+ * page FIFO of one process, so processes do memory operations in
+ * parallel. Locks are taken in this order:
+ *
+ *   1. mm->lock of the caller, held across a whole __alloc/__free/
+ *      __read/__write including the faults and evictions it causes
+ *   2. lru_lock of the global reclaim lists (MM_GLOBAL_RECLAIM)
+ *   3. mm->lock of the owner of a global victim, trylock only: a busy
+ *      owner makes reclaim pass on to another frame
+ *   4. fp_lock of a MEMPHY frame pool, a leaf lock
+ *
+ * A blocking acquisition never goes against this order, and the only
+ * way to hold two mm locks is a trylock, hence no deadlock.
+ */
 
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
@@ -98,7 +112,7 @@ struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
  */
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr)
 {
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
   /*Allocate at the toproof */
   struct vm_rg_struct rgnode;
   int align_size = PAGING_PAGE_ALIGNSZ(size);
@@ -115,14 +129,14 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
     // printf("vvvvvvvvvvvvvvvvvvvvvvvvvvvvv%d %d %d\n", rgnode.rg_start, rgnode.rg_end, incnumpage);
     if (vm_map_ram(caller, rgnode.rg_start, rgnode.rg_end, rgnode.rg_start, incnumpage, newrg) < 0)
     {
-      pthread_mutex_unlock(&mmvm_lock);
+      pthread_mutex_unlock(&caller->mm->lock);
       // print_pgtbl(caller,0,-1);
       return -1;
     }
 
     *alloc_addr = rgnode.rg_start;
     print_pgtbl(caller, 0, -1);
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return 0;
   }
 
@@ -155,7 +169,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
     enlist_vm_freerg_list(caller->mm, rg_free);
   }
   print_pgtbl(caller, 0, -1);
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&caller->mm->lock);
 
   return 0;
 }
@@ -167,37 +181,13 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
  *@size: allocated size
  *
  */
-int clear_pgn_node(struct pcb_t *proc, int pgn)
-{
-  struct pgn_t *newlist = NULL;
-  struct pgn_t *temp = proc->mm->fifo_pgn;
-  if (temp == NULL)
-    return -1;
-  while (temp != NULL)
-  {
-    if (temp->pgn == pgn)
-    {
-      if (newlist == NULL)
-      {
-        proc->mm->fifo_pgn = temp->pg_next;
-      }
-      else
-      {
-        newlist->pg_next = temp->pg_next;
-      }
-    }
-    newlist = temp;
-    temp = temp->pg_next;
-  }
-  return 0;
-}
 int __free(struct pcb_t *caller, int vmaid, int rgid)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
 
   if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
   {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
 
@@ -206,7 +196,7 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
 
   if (rgnode->rg_start == 0 && rgnode->rg_end == 0) // end == start
   {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
   int inc_sz = rgnode->rg_end - rgnode->rg_start;
@@ -217,11 +207,19 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
   {
 
 #ifdef CPU_TLB
-    tlb_clear_tlb_entry(caller->tlb, caller->pid, pgn + i);
+    tlb_shootdown(caller->tlb, caller->pid, pgn + i);
 #endif
-    MEMPHY_put_freefp(caller->mram, PAGING_FPN(caller->mm->pgd[pgn + i]));
-    CLRBIT(caller->mm->pgd[pgn + i], PAGING_PTE_PRESENT_MASK);
-    clear_pgn_node(caller, pgn + i);
+    uint32_t pte = pte_get(caller->mm, pgn + i);
+    if (!PAGING_PAGE_PRESENT(pte))
+      continue;
+    if (PAGING_PAGE_SWAPPED(pte))
+      MEMPHY_put_freefp(caller->active_mswp, PAGING_PTE_SWPOFF(pte));
+    else
+    {
+      delist_frame(caller, PAGING_PTE_FPN(pte));
+      MEMPHY_put_freefp(caller->mram, PAGING_PTE_FPN(pte));
+    }
+    CLRBIT(*pte_lookup(caller->mm, pgn + i), PAGING_PTE_PRESENT_MASK);
   }
   struct vm_rg_struct *freerg_node = malloc(sizeof(struct vm_rg_struct));
   freerg_node->rg_start = rgnode->rg_start;
@@ -235,7 +233,7 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
   /*enlist the obsoleted memory region */
   enlist_vm_freerg_list(caller->mm, freerg_node);
   print_pgtbl(caller, 0, -1);
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&caller->mm->lock);
   return 0;
 }
 /*pgalloc - PAGING-based allocate a region memory
@@ -271,49 +269,34 @@ int pgfree_data(struct pcb_t *proc, uint32_t reg_index)
  */
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 {
-  uint32_t pte = mm->pgd[pgn];
+  uint32_t pte = pte_get(mm, pgn);
 
   if (!PAGING_PAGE_PRESENT(pte))
-  { /* Page is not online, make it actively living */
-    int vicpgn, swpfpn;
-    int vicfpn;
-    uint32_t vicpte;
-    int tgtfpn = PAGING_SWP(pte); // the target frame storing our variable
-
-    /* TODO: Play with your paging theory here */
-    /* Find victim page */
-    if (find_victim_page(caller->mm, &vicpgn) == -1)
-    {
-      return -1;
-    }
-    /* Get free frame in MEMSWP */
-    if (MEMPHY_get_freefp(caller->active_mswp, &swpfpn) == -1)
-    {
-      return -1;
-    }
-    vicpte = mm->pgd[vicpgn];
-    vicfpn = PAGING_FPN(vicpte);
-
-    /* Do swap frame from MEMRAM to MEMSWP and vice versa*/
-    /* Copy victim frame to swap */
-    __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-    /* Copy target frame from swap to mem */
-    __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicfpn);
+    return -1; /* page is not mapped */
 
-    // print_pgtbl(caller, 0, -1);
-    // printf("setaaaaaaaaaaaaaaaa%d: %d: %08x\n", vicpgn, swpfpn, mm->pgd[vicpgn]);
+  if (PAGING_PAGE_SWAPPED(pte))
+  { /* Page is not online, make it actively living */
+    int tgtswp = PAGING_PTE_SWPOFF(pte); // the swap frame storing our variable
+    int tgtfpn;
 
-    pte_set_swap(&mm->pgd[vicpgn], 0, swpfpn);
+    /* Take a free frame, or free one up by swapping out a victim page */
+    int direct = MEMPHY_get_freefp(caller->mram, &tgtfpn) == -1;
+    if (direct && __swap_out_victim(caller, &tgtfpn) == -1)
+      return -1;
+    pgrep_account_bg(!direct, 0);
 
-    // print_pgtbl(caller, 0, -1);
+    /* Copy target frame from swap to mem and release its swap frame */
+    __swap_cp_page(caller->active_mswp, tgtswp, caller->mram, tgtfpn);
+    MEMPHY_put_freefp(caller->active_mswp, tgtswp);
+    pgrep_account(1, 0, 1);
 
     /* Update its online status of the target page */
-    pte_set_fpn(&mm->pgd[pgn], vicfpn);
+    pte_set_fpn(pte_lookup(mm, pgn), tgtfpn);
 
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
+    enlist_frame(caller, tgtfpn, pgn);
   }
 
-  *fpn = PAGING_FPN(pte);
+  *fpn = PAGING_PTE_FPN(pte_get(mm, pgn));
   return 0;
 }
 
@@ -333,6 +316,10 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
 
+  /* Atomic, reclaim and TLB hits update the PTE without the mm lock */
+  __atomic_fetch_or(pte_lookup(mm, pgn), PAGING_PTE_ACCESSED_MASK, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&mm->vtime, 1, __ATOMIC_RELAXED);
+
   int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
 
   MEMPHY_read(caller->mram, phyaddr, data);
@@ -354,6 +341,9 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   /* Get the page to MEMRAM, swap from MEMSWAP    if needed */
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
+  /* Atomic, reclaim and TLB hits update the PTE without the mm lock */
+  __atomic_fetch_or(pte_lookup(mm, pgn), PAGING_PTE_ACCESSED_MASK, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&mm->vtime, 1, __ATOMIC_RELAXED);
   int phyaddr = (fpn << PAGING_ADDR_FPN_LOBIT) + off;
   MEMPHY_write(caller->mram, phyaddr, value);
 
@@ -389,25 +379,26 @@ int check_if_in_freerg_list(struct pcb_t *caller, int vmaid, struct vm_rg_struct
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
   {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
   if (check_if_in_freerg_list(caller, vmaid, currg) == -1)
   {
     printf("Read in free area.\n");
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
-  pthread_mutex_unlock(&mmvm_lock);
-  return 0;
+  /* Fails when the page cannot be brought in, data is then not set */
+  int val = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  pthread_mutex_unlock(&caller->mm->lock);
+  return val;
 }
 
 /*pgwrite - PAGING-based read a region memory */
@@ -446,24 +437,24 @@ int pgread(
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
 {
-  pthread_mutex_lock(&mmvm_lock);
+  pthread_mutex_lock(&caller->mm->lock);
   struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
   if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
   {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
   if (check_if_in_freerg_list(caller, vmaid, currg) == -1)
   {
     printf("Write in free area.\n");
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
   }
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
-  pthread_mutex_unlock(&mmvm_lock);
-  return 0;
+  int val = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  pthread_mutex_unlock(&caller->mm->lock);
+  return val;
 }
 
 /*pgwrite - PAGING-based write a region memory */
@@ -488,31 +479,64 @@ int pgwrite(
   return num;
 }
 
-/*free_pcb_memphy - collect all memphy of pcb
+/*release_pte - give back the frame or swap slot held by a page
+ *@mm: memory region
+ *@pgn: page number
+ *@pte: its page table entry
+ *@arg: owner process
+ */
+static int release_pte(struct mm_struct *mm, int pgn, uint32_t *pte, void *arg)
+{
+  struct pcb_t *caller = (struct pcb_t *)arg;
+
+  if (!PAGING_PAGE_PRESENT(*pte))
+    return 0;
+
+  if (PAGING_PAGE_SWAPPED(*pte))
+    MEMPHY_put_freefp(caller->active_mswp, PAGING_PTE_SWPOFF(*pte));
+  else
+  {
+    delist_frame(caller, PAGING_PTE_FPN(*pte));
+    MEMPHY_put_freefp(caller->mram, PAGING_PTE_FPN(*pte));
+  }
+  *pte = 0;
+
+  return 0;
+}
+
+/*free_pcb_memphy - collect all memphy of pcb and tear down its mm
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *
+ * Called once the process has finished
  */
 int free_pcb_memph(struct pcb_t *caller)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma, *nextvma;
+  struct vm_rg_struct *rg, *nextrg;
 
-  for (pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
-  {
-    pte = caller->mm->pgd[pagenum];
+  if (mm == NULL)
+    return -1;
 
-    if (!PAGING_PAGE_PRESENT(pte))
-    {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    }
-    else
+  /* Reclaim may still pick our frames until they are delisted */
+  pthread_mutex_lock(&mm->lock);
+  pte_walk(mm, 0, PAGING_MAX_PGN, release_pte, caller);
+  pthread_mutex_unlock(&mm->lock);
+
+  pgtbl_free(mm);
+  for (vma = mm->mmap; vma != NULL; vma = nextvma)
+  {
+    for (rg = vma->vm_freerg_list; rg != NULL; rg = nextrg)
     {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);
+      nextrg = rg->rg_next;
+      free(rg);
     }
+    nextvma = vma->vm_next;
+    free(vma);
   }
+  pthread_mutex_destroy(&mm->lock);
+  free(mm);
+  caller->mm = NULL;
 
   return 0;
 }
@@ -617,27 +641,111 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
  */
 int find_victim_page(struct mm_struct *mm, int *retpgn)
 {
-  struct pgn_t *pg = mm->fifo_pgn;
+  /* Ask the page replacement policy in use */
+  return pgrep->victim(mm, retpgn);
+}
 
-  /* TODO: Implement the theorical mechanism to find the victim page */
-  if (pg == NULL)
-  {
+/*swap_out_page - move a victim page to swap
+ *@mram: RAM device
+ *@mswp: swap device
+ *@vicmm: mm to take the victim from
+ *@retfpn: return the released RAM frame
+ *
+ * With MM_GLOBAL_RECLAIM the victim is the coldest frame of the whole
+ * RAM, which may belong to another process than @vicmm (NULL for none);
+ * its owner's PTE is fixed up under the owner's lock
+ */
+static int swap_out_page(struct memphy_struct *mram, struct memphy_struct *mswp,
+                         struct mm_struct *vicmm, int *retfpn)
+{
+#if defined(MM_GLOBAL_RECLAIM) || defined(CPU_TLB)
+  struct mm_struct *self = vicmm;
+#endif
+  int vicpgn, vicfpn, swpfpn;
+
+  /* Get free frame in MEMSWP */
+  if (MEMPHY_get_freefp(mswp, &swpfpn) == -1)
     return -1;
-  }
-  struct pgn_t *pre = NULL;
-  while (pg->pg_next)
+
+  /* Find victim page */
+#ifdef MM_GLOBAL_RECLAIM
+  if (lru_reclaim(mram, self, &vicmm, &vicpgn) == -1)
+#else
+  if (find_victim_page(vicmm, &vicpgn) == -1)
+#endif
   {
-    pre = pg;
-    pg = pg->pg_next;
+    MEMPHY_put_freefp(mswp, swpfpn);
+    return -1;
   }
-  *retpgn = pg->pgn;
-  pre->pg_next = NULL;
+  vicfpn = PAGING_PTE_FPN(pte_get(vicmm, vicpgn));
 
-  free(pg);
+#ifdef CPU_TLB
+  if (vicmm != self && vicmm->on_cpu)
+    /* Running on another CPU, its TLB hits must be done with the frame
+     * before it is copied out and reused */
+    tlb_shootdown_sync(vicmm->asid, vicpgn, &vicmm->tlb_users);
+  else
+    /* The owner may have run on any CPU, they flush before running it */
+    tlb_shootdown(NULL, vicmm->asid, vicpgn);
+#endif
+  /* Copy victim frame to swap */
+  __swap_cp_page(mram, vicfpn, mswp, swpfpn);
+  pte_set_swap(pte_lookup(vicmm, vicpgn), 0, swpfpn);
+  pgrep_account(0, 1, 0);
+#ifdef MM_GLOBAL_RECLAIM
+  if (vicmm != self)
+    pthread_mutex_unlock(&vicmm->lock);
+#endif
 
+  *retfpn = vicfpn;
   return 0;
 }
 
+/*__swap_out_victim - move a victim page of caller to swap
+ *@caller: caller
+ *@retfpn: return the released RAM frame
+ *
+ */
+int __swap_out_victim(struct pcb_t *caller, int *retfpn)
+{
+  return swap_out_page(caller->mram, caller->active_mswp, caller->mm, retfpn);
+}
+
+#ifdef MM_KSWAPD
+/*kswapd_reclaim - keep the free RAM frames above the watermarks
+ *@mram: RAM device
+ *@mswp: swap device the cold pages go to
+ *
+ * The watermarks are a share of the RAM frames, at least 1 and 2.
+ * It stops early when only recently accessed pages are left
+ * Return the number of pages moved to swap
+ */
+int kswapd_reclaim(struct memphy_struct *mram, struct memphy_struct *mswp)
+{
+  int nr = 0, fpn;
+  int low = mram->numfp * KSWAPD_LOW_WMARK_PCT / 100;
+  int high = mram->numfp * KSWAPD_HIGH_WMARK_PCT / 100;
+
+  if (low < 1)
+    low = 1;
+  if (high <= low)
+    high = low + 1;
+
+  if (MEMPHY_nr_freefp(mram) < low)
+  {
+    while (MEMPHY_nr_freefp(mram) < high &&
+           swap_out_page(mram, mswp, NULL, &fpn) == 0)
+    {
+      MEMPHY_put_freefp(mram, fpn);
+      nr++;
+    }
+  }
+
+  pgrep_account_bg(0, nr);
+  return nr;
+}
+#endif
+
 /*get_free_vmrg_area - get a free vm region
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -7,6 +7,7 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /* 
  * init_pte - Initialize PTE entry
@@ -69,6 +70,7 @@ int pte_set_fpn(uint32_t *pte, int fpn)
 {
   SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
   CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+  CLRBIT(*pte, PAGING_PTE_ACCESSED_MASK);
 
   SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT); 
 
@@ -76,50 +78,147 @@ int pte_set_fpn(uint32_t *pte, int fpn)
 }
 
 
+/* 
+ * pte_lookup - get the PTE of a page, NULL if its leaf table is absent
+ * @mm  : memory management instance
+ * @pgn : page number
+ */
+uint32_t *pte_lookup(struct mm_struct *mm, int pgn)
+{
+  uint32_t *leaf;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+
+  leaf = mm->pgd[PAGING_PT_DIR(pgn)];
+  if (leaf == NULL)
+    return NULL;
+
+  return &leaf[PAGING_PT_LEAF(pgn)];
+}
+
+/* 
+ * pte_alloc - get the PTE of a page, allocating its leaf table if needed
+ * @mm  : memory management instance
+ * @pgn : page number
+ */
+uint32_t *pte_alloc(struct mm_struct *mm, int pgn)
+{
+  uint32_t **dir;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+
+  dir = &mm->pgd[PAGING_PT_DIR(pgn)];
+  if (*dir == NULL)
+    *dir = calloc(PAGING_PT_LEAF_SZ, sizeof(uint32_t));
+  if (*dir == NULL)
+    return NULL;
+
+  return &(*dir)[PAGING_PT_LEAF(pgn)];
+}
+
+/* 
+ * pte_get - read the PTE of a page, pages never touched read as 0
+ * @mm  : memory management instance
+ * @pgn : page number
+ */
+uint32_t pte_get(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte = pte_lookup(mm, pgn);
+
+  return (pte != NULL) ? *pte : 0;
+}
+
+/* 
+ * pte_walk - call fn on every PTE of [start, end) with a leaf table
+ * @mm    : memory management instance
+ * @start : first page number
+ * @end   : page number after the last one
+ * @fn    : callback, a non zero return stops the walk and is returned
+ * @arg   : passed to fn
+ */
+int pte_walk(struct mm_struct *mm, int start, int end,
+             int (*fn)(struct mm_struct *mm, int pgn, uint32_t *pte, void *arg),
+             void *arg)
+{
+  int pgn, ret;
+
+  if (start < 0)
+    start = 0;
+  if (end > PAGING_MAX_PGN)
+    end = PAGING_MAX_PGN;
+
+  for (pgn = start; pgn < end; )
+  {
+    uint32_t *leaf = mm->pgd[PAGING_PT_DIR(pgn)];
+    int leaf_end = (PAGING_PT_DIR(pgn) + 1) << PAGING_PT_LEAF_BITS;
+
+    if (leaf_end > end)
+      leaf_end = end;
+
+    /* Skip a whole untouched range at once */
+    if (leaf == NULL)
+    {
+      pgn = leaf_end;
+      continue;
+    }
+
+    for (; pgn < leaf_end; pgn++)
+      if ((ret = fn(mm, pgn, &leaf[PAGING_PT_LEAF(pgn)], arg)) != 0)
+        return ret;
+  }
+
+  return 0;
+}
+
+/* 
+ * pgtbl_free - release all the page table of mm
+ * @mm : memory management instance
+ */
+int pgtbl_free(struct mm_struct *mm)
+{
+  int dir;
+
+  for (dir = 0; dir < PAGING_PT_DIR_SZ; dir++)
+    free(mm->pgd[dir]);
+  free(mm->pgd);
+  mm->pgd = NULL;
+
+  return 0;
+}
+
 /* 
  * vmap_page_range - map a range of page at aligned address
  */
 int vmap_page_range(struct pcb_t *caller, // process call
                                 int addr, // start address which is aligned to pagesz
                                int pgnum, // num of mapping page
-           struct framephy_struct *frames,// list of the mapped frames
+                             int *frames, // array of the pgnum mapped frames
               struct vm_rg_struct *ret_rg)// return mapped region, the real mapped fp
 {                                         // no guarantee all given pages are mapped
-  //uint32_t * pte = malloc(sizeof(uint32_t));
-  struct framephy_struct *fpit = malloc(sizeof(struct framephy_struct));
-  //int  fpn;
   int pgit = 0;
   int pgn = PAGING_PGN(addr);
 
   ret_rg->rg_end = ret_rg->rg_start = addr; // at least the very first space is usable
 
-  fpit->fp_next = frames;
-
   /* TODO map range of frame to address space 
    *      [addr to addr + pgnum*PAGING_PAGESZ
-   *      in page table caller->mm->pgd[]
+   *      in page table caller->mm->pgd
    */
-  fpit = frames;
   for (pgit = 0; pgit < pgnum; pgit++)
   {
     // Mapping
     pgn = PAGING_PGN((addr + pgit * PAGING_PAGESZ));
-    uint32_t *pte = &caller->mm->pgd[pgn];
-    pte_set_fpn(pte, fpit->fpn);
-    // Delete
-    struct framephy_struct *tmp = fpit;
-    fpit = fpit->fp_next;
-    free(tmp);
+    uint32_t *pte = pte_alloc(caller->mm, pgn);
+    if (pte == NULL)
+      return -1;
+    pte_set_fpn(pte, frames[pgit]);
+
+    /* Tracking for later page replacement activities
+     * Enqueue new usage page */
+    enlist_frame(caller, frames[pgit], pgn);
   }
-  // List the pages to pgn list
-  for (pgit = pgnum - 1; pgit >= 0; pgit--)
-  {
-    pgn = PAGING_PGN((addr + pgit * PAGING_PAGESZ));
-    enlist_pgn_node(&caller->mm->fifo_pgn, pgn);
-  }
-   /* Tracking for later page replacement activities (if needed)
-    * Enqueue new usage page */
-   enlist_pgn_node(&caller->mm->fifo_pgn, pgn+pgit);
 
 
   return 0;
@@ -129,37 +228,37 @@ int vmap_page_range(struct pcb_t *caller, // process call
  * alloc_pages_range - allocate req_pgnum of frame in ram
  * @caller    : caller
  * @req_pgnum : request page num
- * @frm_lst   : frame list
+ * @frm_lst   : returned array of req_pgnum frames
  */
 
-int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct** frm_lst)
+int alloc_pages_range(struct pcb_t *caller, int req_pgnum, int *frm_lst)
 {
-  int pgit, fpn;
-  //struct framephy_struct *newfp_str;
+  int pgit, fpn, tmp;
+
+  /* Take all the frames the RAM can give at once */
+  pgit = MEMPHY_get_freefp_n(caller->mram, req_pgnum, frm_lst);
 
-  for(pgit = 0; pgit < req_pgnum; pgit++)
+  for(; pgit < req_pgnum; pgit++)
   {
-    struct framephy_struct *new_fp = malloc(sizeof(struct framephy_struct));
-    if(MEMPHY_get_freefp(caller->mram, &fpn) == 0)
-   {
-   } else {  // ERROR CODE of obtaining somes but not enough frames
-    int vicpgn;
-      find_victim_page(caller->mm, &vicpgn);
-      uint32_t vic_pte = caller->mm->pgd[vicpgn];
-      int vicfpn = PAGING_FPN(vic_pte);
-      // Find a free frame in mswp
-      int swpfpn;
-      MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
-      // Copy content from mram to mswp
-      __swap_cp_page(caller->mram, vicfpn, caller->active_mswp, swpfpn);
-      pte_set_swap(&caller->mm->pgd[vicpgn], 0, swpfpn);
-      // Return this victim frame to the free frame list
-      fpn = vicfpn;
-   }
-    new_fp->fpn = fpn;
-    new_fp->fp_next = *frm_lst;
-    *frm_lst = new_fp;
- }
+    // ERROR CODE of obtaining somes but not enough frames
+    /* Swap out a victim page and reuse its frame */
+    if (__swap_out_victim(caller, &fpn) < 0)
+    {
+      /* Give back what was obtained so far */
+      while (pgit-- > 0)
+        MEMPHY_put_freefp(caller->mram, frm_lst[pgit]);
+      return -3000;
+    }
+    frm_lst[pgit] = fpn;
+  }
+
+  /* Pages take the frames in reverse order of allocation */
+  for(pgit = 0; pgit < req_pgnum / 2; pgit++)
+  {
+    tmp = frm_lst[pgit];
+    frm_lst[pgit] = frm_lst[req_pgnum - 1 - pgit];
+    frm_lst[req_pgnum - 1 - pgit] = tmp;
+  }
 
   return 0;
 }
@@ -176,9 +275,15 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
  */
 int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
-  struct framephy_struct *frm_lst = NULL;
   int ret_alloc;
 
+  /* A mapping never exceeds the address space, so the frame list fits
+   * on the stack (at most PAGING_MAX_PGN ints) and no heap is used */
+  if (incpgnum < 0 || incpgnum > PAGING_MAX_PGN)
+    return -1;
+
+  int frm_lst[incpgnum > 0 ? incpgnum : 1];
+
   /*@bksysnet: author provides a feasible solution of getting frames
    *FATAL logic in here, wrong behaviour if we have not enough page
    *i.e. we request 1000 frames meanwhile our RAM has size of 3 frames
@@ -186,7 +291,7 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
    *in endless procedure of swap-off to get frame and we have not provide 
    *duplicate control mechanism, keep it simple
    */
-  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
+  ret_alloc = alloc_pages_range(caller, incpgnum, frm_lst);
 
   if (ret_alloc < 0 && ret_alloc != -3000)
     return -1;
@@ -216,19 +321,12 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) 
 {
-  int cellidx;
-  int addrsrc,addrdst;
-  for(cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
+  BYTE buf[PAGING_PAGESZ];
 
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
+  if (MEMPHY_read_frame(mpsrc, srcfpn, buf) < 0)
+    return -1;
 
-  return 0;
+  return MEMPHY_write_frame(mpdst, dstfpn, buf);
 }
 
 /*
@@ -240,7 +338,14 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct * vma = malloc(sizeof(struct vm_area_struct));
 
-  mm->pgd = malloc(PAGING_MAX_PGN*sizeof(uint32_t));
+  pthread_mutex_init(&mm->lock, NULL);
+  mm->pgd = calloc(PAGING_PT_DIR_SZ, sizeof(uint32_t *));
+  mm->fifo_head = mm->fifo_tail = NULL;
+  mm->vtime = 0;
+  mm->asid = caller->pid;
+  mm->on_cpu = 0;
+  mm->tlb_users = 0;
+  memset(mm->symrgtbl, 0, sizeof(mm->symrgtbl));
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 1;
@@ -248,6 +353,7 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   vma->vm_end = vma->vm_start;
   vma->sbrk = vma->vm_start;
   struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
+  vma->vm_freerg_list = NULL;
   enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
 
   vma->vm_next = NULL;
@@ -277,13 +383,83 @@ int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode)
   return 0;
 }
 
-int enlist_pgn_node(struct pgn_t **plist, int pgn)
+/*
+ * enlist_frame - track a newly mapped frame for page replacement
+ * @caller : owner process
+ * @fpn    : RAM frame
+ * @pgn    : page mapped on the frame
+ */
+int enlist_frame(struct pcb_t *caller, int fpn, int pgn)
 {
-  struct pgn_t* pnode = malloc(sizeof(struct pgn_t));
+  struct framephy_struct *fp = &caller->mram->fp_tbl[fpn];
+
+  fp->owner = caller->mm;
+  fp->pgn = pgn;
+#ifdef MM_GLOBAL_RECLAIM
+  return lru_add_frame(caller->mram, fp);
+#else
+  return enlist_fifo_frame(caller->mm, fp);
+#endif
+}
 
-  pnode->pgn = pgn;
-  pnode->pg_next = *plist;
-  *plist = pnode;
+/*
+ * delist_frame - stop tracking a frame which is being unmapped
+ * @caller : owner process
+ * @fpn    : RAM frame
+ */
+int delist_frame(struct pcb_t *caller, int fpn)
+{
+  struct framephy_struct *fp = &caller->mram->fp_tbl[fpn];
+
+#ifdef MM_GLOBAL_RECLAIM
+  return lru_del_frame(caller->mram, fp);
+#else
+  return delist_fifo_frame(caller->mm, fp);
+#endif
+}
+
+/*
+ * enlist_fifo_frame - append a resident frame to the FIFO tail of mm
+ * @mm : owner mm
+ * @fp : frame table entry of the page
+ */
+int enlist_fifo_frame(struct mm_struct *mm, struct framephy_struct *fp)
+{
+  fp->fp_next = NULL;
+  fp->fp_prev = mm->fifo_tail;
+  fp->age = 0;
+  fp->last_use = mm->vtime;
+
+  if (mm->fifo_tail != NULL)
+    mm->fifo_tail->fp_next = fp;
+  else
+    mm->fifo_head = fp;
+  mm->fifo_tail = fp;
+
+  return 0;
+}
+
+/*
+ * delist_fifo_frame - unlink a frame from anywhere in the FIFO of mm
+ * @mm : owner mm
+ * @fp : frame table entry of the page
+ */
+int delist_fifo_frame(struct mm_struct *mm, struct framephy_struct *fp)
+{
+  if (fp->fp_prev != NULL)
+    fp->fp_prev->fp_next = fp->fp_next;
+  else if (mm->fifo_head == fp)
+    mm->fifo_head = fp->fp_next;
+  else
+    return -1; /* not enlisted */
+
+  if (fp->fp_next != NULL)
+    fp->fp_next->fp_prev = fp->fp_prev;
+  else
+    mm->fifo_tail = fp->fp_prev;
+
+  fp->fp_next = fp->fp_prev = NULL;
+  fp->owner = NULL;
 
   return 0;
 }
@@ -351,10 +527,18 @@ int print_list_pgn(struct pgn_t *ip)
    return 0;
 }
 
+/* pte_walk callback of print_pgtbl, one line per PTE */
+static int print_pte(struct mm_struct *mm, int pgn, uint32_t *pte, void *arg)
+{
+  printf("%08ld: %08x\n", pgn * sizeof(uint32_t),
+         *pte & ~PAGING_PTE_ACCESSED_MASK);
+
+  return 0;
+}
+
 int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
 {
   int pgn_start,pgn_end;
-  int pgit;
 
   if(end == -1){
     pgn_start = 0;
@@ -369,10 +553,8 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
     printf("\n");
 
 
-  for(pgit = pgn_start; pgit < pgn_end; pgit++)
-  {
-     printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
-  }
+  /* Ranges without a leaf table were never mapped, skip them */
+  pte_walk(caller->mm, pgn_start, pgn_end, print_pte, NULL);
 
   return 0;
 }
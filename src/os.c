@@ -1,7 +1,7 @@
 
 #include "cpu.h"
 #include "timer.h"
-#include "sched.h"
+#include "mlq_sched.h"
 #include "loader.h"
 #include "mm.h"
 
@@ -13,9 +13,11 @@
 static int time_slot;
 static int num_cpus;
 static int done = 0;
+static int cpus_stopped = 0;
 
 #ifdef CPU_TLB
 static int tlbsz;
+static int tlbways;
 #endif
 
 #ifdef MM_PAGING
@@ -24,7 +26,6 @@ static int memswpsz[PAGING_MAX_MMSWP];
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
-	struct memphy_struct *tlb;
 	struct memphy_struct *mram;
 	struct memphy_struct **mswp;
 	struct memphy_struct *active_mswp;
@@ -32,6 +33,10 @@ struct mmpaging_ld_args {
 };
 #endif
 
+#ifdef MM_KSWAPD
+static struct timer_id_t * kswapd_event;
+#endif
+
 static struct ld_args{
 	char ** path;
 	unsigned long * start_time;
@@ -44,84 +49,165 @@ int num_processes;
 struct cpu_args {
 	struct timer_id_t * timer_id;
 	int id;
+	/* State kept between two cpu_step() */
+	struct pcb_t * proc;
+	int time_left;
+	/* Slots the last cpu_step() keeps the CPU busy for */
+	int slots;
+#ifdef CPU_TLB
+	/* TLB of this CPU, lent to the process it runs */
+	struct memphy_struct * tlb;
+#endif
+};
+
+/* Outcome of one time slot of a CPU or of the loader */
+enum step_t {
+	STEP_BUSY,	// Did some work, run again in the next slot
+	STEP_IDLE,	// CPU found nothing to run
+	STEP_WAIT,	// Loader waits for the start time of the next process
+	STEP_DONE	// Finished, detach from the timer
 };
 
+/* Next index of ld_processes to publish */
+static int ld_next = 0;
+
+/* Loader pipeline: worker threads build the PCBs of the processes
+ * ld_next .. ld_next + LOADER_PREFETCH - 1 ahead of their start time,
+ * ld_step only publishes them. ld_lock guards ld_ready, ld_claim and
+ * the writes of ld_next, ld_cond signals a PCB ready or ld_next moved */
+static struct pcb_t ** ld_ready;
+static int ld_claim = 0;
+static pthread_mutex_t ld_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ld_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ld_workers[LOADER_WORKERS];
+
+static int cpu_step(struct cpu_args * cpu) {
+	int id = cpu->id;
+#ifdef MM_PAGING
+	int stall;
+#endif
+	/* Check the status of current process */
+	if (cpu->proc == NULL) {
+		/* No process is running, the we load new process from
+		 * ready queue */
+		cpu->proc = get_proc(id);
+	}else if (cpu->proc->pc == cpu->proc->code->size) {
+		/* The porcess has finish it job */
+		printf("\tCPU %d: Processed %2d has finished\n",
+			id ,cpu->proc->pid);
+#ifdef MM_PAGING
+		free_pcb_memph(cpu->proc);
+#endif
+		unload(cpu->proc);
+		cpu->proc = get_proc(id);
+		cpu->time_left = 0;
+	}else if (cpu->time_left == 0) {
+		/* The process has done its job in current time slot */
+		printf("\tCPU %d: Put process %2d to run queue\n",
+			id, cpu->proc->pid);
+#if defined(CPU_TLB) && defined(MM_PAGING)
+		__atomic_store_n(&cpu->proc->mm->on_cpu, 0, __ATOMIC_RELEASE);
+#endif
+		put_proc(id, cpu->proc);
+		cpu->proc = get_proc(id);
+	}
+
+	/* Recheck process status after loading new process */
+	if (cpu->proc == NULL && done) {
+		/* No process to run, exit */
+		printf("\tCPU %d stopped\n", id);
+		__atomic_fetch_add(&cpus_stopped, 1, __ATOMIC_RELEASE);
+		return STEP_DONE;
+	}else if (cpu->proc == NULL) {
+		/* There may be new processes to run in
+		 * next time slots, just skip current slot */
+		return STEP_IDLE;
+	}else if (cpu->time_left == 0) {
+		printf("\tCPU %d: Dispatched process %2d\n",
+			id, cpu->proc->pid);
+		cpu->time_left = time_slot;
+#ifdef CPU_TLB
+		/* Entries are tagged by pid, a switch needs no flush */
+		cpu->proc->tlb = cpu->tlb;
+#ifdef MM_PAGING
+		/* Under the lock: a reclaim of our pages is either done, its
+		 * shootdown queued for the flush below, or sees us running */
+		pthread_mutex_lock(&cpu->proc->mm->lock);
+		cpu->proc->mm->on_cpu = 1;
+		pthread_mutex_unlock(&cpu->proc->mm->lock);
+#endif
+#endif
+	}
+
+#ifdef CPU_TLB
+	/* Invalidations other CPUs sent since our last slot */
+	tlb_shootdown_flush(cpu->tlb);
+#endif
+
+	/* Run current process */
+	cpu->slots = 1;
+#ifdef CPU_CALC_BATCH
+	/* CALCs only take time, retire as many as the slice allows at
+	 * once: nothing can happen to the process in the meantime */
+	cpu->slots = calc_run(cpu->proc);
+	if (cpu->slots > cpu->time_left) {
+		cpu->slots = cpu->time_left;
+	}else if (cpu->slots == 0) {
+		cpu->slots = 1;
+	}
+#endif
+	run_slice(cpu->proc, cpu->slots);
+	cpu->time_left -= cpu->slots;
+#ifdef MM_PAGING
+	/* The process holds the CPU while a sequential device seeks for
+	 * it, the wait comes out of its time slice */
+	stall = MEMPHY_seek_slots();
+	cpu->slots += stall;
+	cpu->time_left = (stall < cpu->time_left) ? cpu->time_left - stall : 0;
+#endif
+	return STEP_BUSY;
+}
 
 static void * cpu_routine(void * args) {
-	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
-	int id = ((struct cpu_args*)args)->id;
-	/* Check for new process in ready queue */
-	int time_left = 0;
-	struct pcb_t * proc = NULL;
-	while (1) {
-		/* Check the status of current process */
-		if (proc == NULL) {
-			/* No process is running, the we load new process from
-		 	* ready queue */
-			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
-		}else if (proc->pc == proc->code->size) {
-			/* The porcess has finish it job */
-			printf("\tCPU %d: Processed %2d has finished\n",
-				id ,proc->pid);
-			free(proc);
-			proc = get_proc();
-			time_left = 0;
-		}else if (time_left == 0) {
-			/* The process has done its job in current time slot */
-			printf("\tCPU %d: Put process %2d to run queue\n",
-				id, proc->pid);
-			put_proc(proc);
-			proc = get_proc();
-		}
-		
-		/* Recheck process status after loading new process */
-		if (proc == NULL && done) {
-			/* No process to run, exit */
-			printf("\tCPU %d stopped\n", id);
-			break;
-		}else if (proc == NULL) {
-			/* There may be new processes to run in
-			 * next time slots, just skip current slot */
-			next_slot(timer_id);
-			continue;
-		}else if (time_left == 0) {
-			printf("\tCPU %d: Dispatched process %2d\n",
-				id, proc->pid);
-			time_left = time_slot;
+	struct cpu_args * cpu = (struct cpu_args*)args;
+	int stat;
+	while ((stat = cpu_step(cpu)) != STEP_DONE) {
+		if (stat == STEP_IDLE) {
+			next_slot_idle(cpu->timer_id, TIMER_NEVER);
+		}else{
+			next_slot_busy(cpu->timer_id, cpu->slots);
 		}
-		
-		/* Run current process */
-		run(proc);
-		time_left--;
-		next_slot(timer_id);
 	}
-	detach_event(timer_id);
+	detach_event(cpu->timer_id);
 	pthread_exit(NULL);
 }
 
-static void * ld_routine(void * args) {
+static void * ld_worker(void * args) {
 #ifdef MM_PAGING
 	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
 	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
 	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
-	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
-#else
-	struct timer_id_t * timer_id = (struct timer_id_t*)args;
 #endif
-	int i = 0;
-	printf("ld_routine\n");
-	while (i < num_processes) {
-		struct pcb_t * proc = load(ld_processes.path[i]);
+	struct pcb_t * proc;
+	int i;
+
+	pthread_mutex_lock(&ld_lock);
+	for (;;) {
+		while (ld_claim < num_processes &&
+				ld_claim >= ld_next + LOADER_PREFETCH) {
+			pthread_cond_wait(&ld_cond, &ld_lock);
+		}
+		if (ld_claim == num_processes) {
+			break;
+		}
+		i = ld_claim++;
+		pthread_mutex_unlock(&ld_lock);
+
+		proc = load(ld_processes.path[i]);
+		decode(proc->code);
 #ifdef MLQ_SCHED
 		proc->prio = ld_processes.prio[i];
 #endif
-		while (current_time() < ld_processes.start_time[i]) {
-			next_slot(timer_id);
-		}
 #ifdef MM_PAGING
 		proc->mm = malloc(sizeof(struct mm_struct));
 		init_mm(proc->mm, proc);
@@ -129,20 +215,273 @@ static void * ld_routine(void * args) {
 		proc->mswp = mswp;
 		proc->active_mswp = active_mswp;
 #endif
-		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
-		add_proc(proc);
-		free(ld_processes.path[i]);
-		i++;
-		next_slot(timer_id);
+
+		pthread_mutex_lock(&ld_lock);
+		ld_ready[i] = proc;
+		pthread_cond_broadcast(&ld_cond);
+	}
+	pthread_mutex_unlock(&ld_lock);
+	return NULL;
+}
+
+static void ld_start_workers(void * args) {
+	int i;
+
+	ld_ready = (struct pcb_t**)calloc(num_processes, sizeof(struct pcb_t*));
+	for (i = 0; i < LOADER_WORKERS; i++) {
+		pthread_create(&ld_workers[i], NULL, ld_worker, args);
+	}
+}
+
+static int ld_step(void * args) {
+	struct pcb_t * proc;
+	int i;
+
+	if (ld_next == num_processes) {
+		for (i = 0; i < LOADER_WORKERS; i++) {
+			pthread_join(ld_workers[i], NULL);
+		}
+		free(ld_ready);
+		free(ld_processes.path);
+		free(ld_processes.start_time);
+		done = 1;
+		return STEP_DONE;
+	}
+	if (current_time() < ld_processes.start_time[ld_next]) {
+		return STEP_WAIT;
+	}
+
+	/* Only a worker lagging behind makes the slot wait */
+	pthread_mutex_lock(&ld_lock);
+	while ((proc = ld_ready[ld_next]) == NULL) {
+		pthread_cond_wait(&ld_cond, &ld_lock);
+	}
+	pthread_mutex_unlock(&ld_lock);
+
+	/* PIDs follow the start order, whichever worker was first */
+	assign_pid(proc);
+#ifdef MM_PAGING
+	proc->mm->asid = proc->pid;
+#endif
+	printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
+		ld_processes.path[ld_next], proc->pid,
+		ld_processes.prio[ld_next]);
+	add_proc(proc);
+	free(ld_processes.path[ld_next]);
+
+	pthread_mutex_lock(&ld_lock);
+	ld_next++;
+	pthread_cond_broadcast(&ld_cond);
+	pthread_mutex_unlock(&ld_lock);
+	return STEP_BUSY;
+}
+
+static void * ld_routine(void * args) {
+#ifdef MM_PAGING
+	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
+#else
+	struct timer_id_t * timer_id = (struct timer_id_t*)args;
+#endif
+	int stat;
+	printf("ld_routine\n");
+	while ((stat = ld_step(args)) != STEP_DONE) {
+		if (stat == STEP_WAIT) {
+			next_slot_idle(timer_id,
+				ld_processes.start_time[ld_next]);
+		}else{
+			next_slot(timer_id);
+		}
 	}
-	free(ld_processes.path);
-	free(ld_processes.start_time);
-	done = 1;
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
 
+#ifdef MM_KSWAPD
+/* Background reclaim: refill the free RAM frames up to the high
+ * watermark once they drop below the low one */
+static int kswapd_step(void * args) {
+	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
+	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
+	int nr;
+
+	if (__atomic_load_n(&cpus_stopped, __ATOMIC_ACQUIRE) == num_cpus) {
+		return STEP_DONE;
+	}
+	nr = kswapd_reclaim(mram, active_mswp);
+	/* Its seeks are background device time, no CPU is charged */
+	MEMPHY_seek_slots();
+	if (nr == 0) {
+		return STEP_IDLE;
+	}
+	printf("\tkswapd: reclaimed %d pages\n", nr);
+	return STEP_BUSY;
+}
+
+static void * kswapd_routine(void * args) {
+	int stat;
+	while ((stat = kswapd_step(args)) != STEP_DONE) {
+		if (stat == STEP_IDLE) {
+			next_slot_idle(kswapd_event, TIMER_NEVER);
+		}else{
+			next_slot(kswapd_event);
+		}
+	}
+	detach_event(kswapd_event);
+	pthread_exit(NULL);
+}
+#endif
+
+/*
+ * Single-threaded discrete-event backend (os --des).
+ * The CPUs and the loader run as state machines popped from a binary
+ * heap of wake-up events ordered by (time, device). Within a slot the
+ * CPUs go first in id order, then the loader, which is one of the
+ * interleavings the threaded mode can produce, so a run is fully
+ * reproducible. An idle CPU is parked and only woken for the slot
+ * after some device made progress; slots in which nobody has anything
+ * to do are jumped over by sim_advance().
+ */
+struct sim_event {
+	uint64_t time;
+	int dev;	// CPU id, num_cpus for the loader, then kswapd
+};
+
+static struct sim_event * evq;
+static int evq_len;
+
+static int evq_before(struct sim_event * a, struct sim_event * b) {
+	return a->time < b->time || (a->time == b->time && a->dev < b->dev);
+}
+
+static void evq_push(uint64_t time, int dev) {
+	int i = evq_len++;
+	evq[i].time = time;
+	evq[i].dev = dev;
+	while (i > 0 && evq_before(&evq[i], &evq[(i - 1) / 2])) {
+		struct sim_event tmp = evq[i];
+		evq[i] = evq[(i - 1) / 2];
+		evq[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+static struct sim_event evq_pop(void) {
+	struct sim_event top = evq[0];
+	int i = 0;
+	evq[0] = evq[--evq_len];
+	while (1) {
+		int min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < evq_len && evq_before(&evq[l], &evq[min])) min = l;
+		if (r < evq_len && evq_before(&evq[r], &evq[min])) min = r;
+		if (min == i) break;
+		struct sim_event tmp = evq[i];
+		evq[i] = evq[min];
+		evq[min] = tmp;
+		i = min;
+	}
+	return top;
+}
+
+static void des_run(struct cpu_args * cpus, void * ld_args) {
+	/* Every device has at most one pending event */
+	int nr_dev = num_cpus + 1;
+#ifdef MM_KSWAPD
+	int kswapd_dev = nr_dev++;
+#endif
+	char * parked = (char*)calloc(nr_dev, sizeof(char));
+	int i;
+	evq = (struct sim_event*)malloc(sizeof(struct sim_event) * nr_dev);
+	evq_len = 0;
+
+	sim_start();
+	printf("ld_routine\n");
+	for (i = 0; i < nr_dev; i++) {
+		evq_push(0, i);
+	}
+
+	while (evq_len > 0) {
+		uint64_t t = evq[0].time;
+		int progress = 0;
+		if (t > current_time()) {
+			sim_advance(t);
+		}
+		while (evq_len > 0 && evq[0].time == t) {
+			struct sim_event ev = evq_pop();
+			if (ev.dev == num_cpus) {
+				switch (ld_step(ld_args)) {
+				case STEP_WAIT:
+					evq_push(ld_processes.start_time[ld_next], ev.dev);
+					break;
+				case STEP_BUSY:
+					evq_push(t + 1, ev.dev);
+					/* fall through */
+				default:
+					/* A new process or done may wake the CPUs */
+					progress = 1;
+				}
+#ifdef MM_KSWAPD
+			}else if (ev.dev == kswapd_dev) {
+				switch (kswapd_step(ld_args)) {
+				case STEP_BUSY:
+					evq_push(t + 1, ev.dev);
+					progress = 1;
+					break;
+				case STEP_IDLE:
+					parked[ev.dev] = 1;
+					break;
+				default:
+					break;
+				}
+#endif
+			}else{
+				switch (cpu_step(&cpus[ev.dev])) {
+				case STEP_BUSY:
+					evq_push(t + cpus[ev.dev].slots, ev.dev);
+					progress = 1;
+					break;
+				case STEP_IDLE:
+					parked[ev.dev] = 1;
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		if (!progress) {
+			continue;
+		}
+		for (i = 0; i < nr_dev; i++) {
+			if (parked[i]) {
+				parked[i] = 0;
+				evq_push(t + 1, i);
+			}
+		}
+	}
+	free(evq);
+	free(parked);
+}
+
+#if defined(CPU_TLB) && !defined(CPUTLB_FIXED_TLBSZ)
+/* A TLB line is one or two numbers alone, the memory line has five
+ * and a process line names its program. Return 1 if [line] is one */
+static int parse_tlb_line(const char * line, int * sz, int * ways) {
+	int a, b;
+	char c;
+
+	if (sscanf(line, "%d %d %c", &a, &b, &c) == 2) {
+		*sz = a;
+		*ways = b;
+		return 1;
+	}
+	if (sscanf(line, "%d %c", &a, &c) == 1) {
+		*sz = a;
+		*ways = 1;
+		return 1;
+	}
+	return 0;
+}
+#endif
+
 static void read_config(const char * path) {
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
@@ -159,13 +498,21 @@ static void read_config(const char * path) {
 	/* We provide here a back compatible with legacy OS simulatiom config file
 	 * In which, it have no addition config line for CPU_TLB
 	 */
-	tlbsz = 0x10000;
+	tlbsz = CPUTLB_DEFAULT_SZ;
+	tlbways = CPUTLB_DEFAULT_WAYS;
 #else
-	/* Read input config of TLB size:
-	 * Format:
-	 *        CPU_TLBSZ
+	/* Read input config of TLB size, in entries, and associativity:
+	 * Format: (no WAYS means direct mapped)
+	 *        CPU_TLBSZ [WAYS]
+	 * The line is optional, without it the default TLB is used
 	*/
-	fscanf(file, "%d\n", &tlbsz);
+	char tlbline[64];
+	long tlbpos = ftell(file);
+	tlbsz = CPUTLB_DEFAULT_SZ;
+	tlbways = CPUTLB_DEFAULT_WAYS;
+	if (fgets(tlbline, sizeof(tlbline), file) == NULL ||
+	    !parse_tlb_line(tlbline, &tlbsz, &tlbways))
+		fseek(file, tlbpos, SEEK_SET);
 #endif
 #endif
 
@@ -190,7 +537,14 @@ static void read_config(const char * path) {
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
 		fscanf(file, "%d", &(memswpsz[sit])); 
 
-	fscanf(file, "\n"); /* Final character */
+	/* An optional page replacement policy may end the line:
+	 *        ... MEM_SWP3_SZ [fifo|clock|lru|wsclock]
+	 */
+	char line[64], policy[16];
+	if (fgets(line, sizeof(line), file) != NULL &&
+	    sscanf(line, "%15s", policy) == 1 && pgrep_select(policy) < 0)
+		printf("Unknown page replacement policy %s, using %s\n",
+			policy, pgrep->name);
 #endif
 #endif
 
@@ -215,9 +569,30 @@ static void read_config(const char * path) {
 }
 
 int main(int argc, char * argv[]) {
+	/* --des runs the whole simulation on one thread, --sched picks
+	 * one MLQ shared by all CPUs or one per CPU */
+	int des = 0;
+#ifdef SCHED_PERCPU
+	int percpu = 1;
+#else
+	int percpu = 0;
+#endif
+	while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+		if (strcmp(argv[1], "--des") == 0) {
+			des = 1;
+		}else if (strcmp(argv[1], "--sched=global") == 0) {
+			percpu = 0;
+		}else if (strcmp(argv[1], "--sched=percpu") == 0) {
+			percpu = 1;
+		}else{
+			break;
+		}
+		argv++;
+		argc--;
+	}
 	/* Read config */
 	if (argc != 2) {
-		printf("Usage: os [path to configure file]\n");
+		printf("Usage: os [--des] [--sched=global|percpu] [path to configure file]\n");
 		return 1;
 	}
 	char path[100];
@@ -230,24 +605,45 @@ int main(int argc, char * argv[]) {
 	struct cpu_args * args =
 		(struct cpu_args*)malloc(sizeof(struct cpu_args) * num_cpus);
 	pthread_t ld;
+#ifdef MM_KSWAPD
+	pthread_t kswapd;
+#endif
 	
 	/* Init timer */
 	int i;
 	for (i = 0; i < num_cpus; i++) {
-		args[i].timer_id = attach_event();
+		args[i].timer_id = des ? NULL : attach_event();
 		args[i].id = i;
+		args[i].proc = NULL;
+		args[i].time_left = 0;
+		args[i].slots = 0;
+	}
+	struct timer_id_t * ld_event = des ? NULL : attach_event();
+#ifdef MM_KSWAPD
+	kswapd_event = des ? NULL : attach_event();
+#endif
+	if (!des) {
+		start_timer();
 	}
-	struct timer_id_t * ld_event = attach_event();
-	start_timer();
 #ifdef CPU_TLB
-	struct memphy_struct tlb;
+	/* One TLB per CPU */
+	struct memphy_struct * tlb =
+		(struct memphy_struct*)malloc(sizeof(struct memphy_struct) * num_cpus);
 
-	init_tlbmemphy(&tlb, tlbsz);
+	for (i = 0; i < num_cpus; i++) {
+		init_tlbmemphy(&tlb[i], tlbsz, tlbways);
+		args[i].tlb = &tlb[i];
+	}
 #endif
 
 #ifdef MM_PAGING
 	/* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
 	int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
+#ifdef MM_SWP_SEQUENTIAL
+	int swprdmflag = 0; /* Tape-like swap, accesses pay seek cost */
+#else
+	int swprdmflag = rdmflag;
+#endif
 
 	struct memphy_struct mram;
 	struct memphy_struct mswp[PAGING_MAX_MMSWP];
@@ -259,7 +655,7 @@ int main(int argc, char * argv[]) {
 	/* Create all MEM SWAP */ 
 	int sit;
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	       init_memphy(&mswp[sit], memswpsz[sit], swprdmflag);
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
@@ -270,37 +666,73 @@ int main(int argc, char * argv[]) {
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
 #endif
 
-#ifdef CPU_TLB
+	/* Init scheduler */
+	init_scheduler(num_cpus, num_processes, percpu);
+#ifdef MLQ_SCHED
+	/* No MLQ level ever holds more than the processes of its priority */
+	int * nr_prio = (int*)calloc(MAX_PRIO, sizeof(int));
+	for (i = 0; i < num_processes; i++) {
+		if (ld_processes.prio[i] < MAX_PRIO) {
+			nr_prio[ld_processes.prio[i]]++;
+		}
+	}
+	for (i = 0; i < MAX_PRIO; i++) {
+		if (nr_prio[i] > 0) {
+			sched_bound_prio(i, nr_prio[i]);
+		}
+	}
+	free(nr_prio);
+#endif
+
 #ifdef MM_PAGING
-	/* In MM_PAGING employ CPU_TLB mode, it needs passing
-	 * the system tlb to each PCB through loader
-	*/
-	mm_ld_args->tlb = (struct memphy_struct *) &tlb;
+	void * ld_args = (void*)mm_ld_args;
+#else
+	void * ld_args = (void*)ld_event;
 #endif
+
+	ld_start_workers(ld_args);
+	if (des) {
+		des_run(args, ld_args);
+	} else {
+		/* Run CPU and loader */
+		pthread_create(&ld, NULL, ld_routine, ld_args);
+#ifdef MM_KSWAPD
+		pthread_create(&kswapd, NULL, kswapd_routine, ld_args);
 #endif
+		for (i = 0; i < num_cpus; i++) {
+			pthread_create(&cpu[i], NULL,
+				cpu_routine, (void*)&args[i]);
+		}
 
-	/* Init scheduler */
-	init_scheduler();
+		/* Wait for CPU and loader finishing */
+		for (i = 0; i < num_cpus; i++) {
+			pthread_join(cpu[i], NULL);
+		}
+		pthread_join(ld, NULL);
+#ifdef MM_KSWAPD
+		pthread_join(kswapd, NULL);
+#endif
+
+		/* Stop timer */
+		stop_timer();
+	}
 
-	/* Run CPU and loader */
 #ifdef MM_PAGING
-	pthread_create(&ld, NULL, ld_routine, (void*)mm_ld_args);
-#else
-	pthread_create(&ld, NULL, ld_routine, (void*)ld_event);
+	pgrep_report();
 #endif
-	for (i = 0; i < num_cpus; i++) {
-		pthread_create(&cpu[i], NULL,
-			cpu_routine, (void*)&args[i]);
-	}
+#ifdef CPU_TLB
+	tlb_report();
+#endif
+#ifdef MM_SWP_SEQUENTIAL
+	for (sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+		char name[16];
 
-	/* Wait for CPU and loader finishing */
-	for (i = 0; i < num_cpus; i++) {
-		pthread_join(cpu[i], NULL);
+		snprintf(name, sizeof(name), "MEMSWP%d", sit);
+		MEMPHY_seek_stats(&mswp[sit], name);
 	}
-	pthread_join(ld, NULL);
+#endif
 
-	/* Stop timer */
-	stop_timer();
+	finish_scheduler();
 
 	return 0;
 
@@ -0,0 +1,41 @@
+/*
+ * progc - compile a process description into the binary program format
+ * the loader maps without parsing (see struct prog_hdr_t)
+ *
+ * Usage: progc <process description> <compiled program>
+ */
+
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char * argv[]) {
+	if (argc != 3) {
+		printf("Usage: progc <process description> <compiled program>\n");
+		return 1;
+	}
+
+	struct pcb_t * proc = load(argv[1]);
+	struct prog_hdr_t hdr = {
+		.magic = PROG_MAGIC,
+		.version = PROG_VERSION,
+		.inst_size = sizeof(struct inst_t),
+		.priority = proc->priority,
+		.size = proc->code->size,
+	};
+
+	FILE * file;
+	if ((file = fopen(argv[2], "wb")) == NULL) {
+		printf("Cannot create compiled program at '%s'\n", argv[2]);
+		return 1;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1 ||
+			fwrite(proc->code->text, sizeof(struct inst_t),
+				proc->code->size, file) != proc->code->size ||
+			fclose(file) != 0) {
+		printf("Cannot write compiled program at '%s'\n", argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -2,42 +2,141 @@
 #include <stdlib.h>
 #include "queue.h"
 
+void init_queue(struct queue_t * q) {
+        q->proc = NULL;
+        q->head = 0;
+        q->size = 0;
+        q->cap = 0;
+}
+
+void free_queue(struct queue_t * q) {
+        free(q->proc);
+        init_queue(q);
+}
+
 int empty(struct queue_t * q) {
         if (q == NULL) return 1;
 	return (q->size == 0);
 }
 
+/* Double the ring buffer, unwrapping the queued processes so that
+ * the oldest one lands on index 0 */
+static int grow(struct queue_t * q) {
+        int cap = q->cap ? q->cap * 2 : QUEUE_INIT_CAP;
+        struct pcb_t ** proc = malloc(sizeof(struct pcb_t *) * cap);
+        if (proc == NULL) return -1;
+        for (int i = 0; i < q->size; i++)
+                proc[i] = q->proc[(q->head + i) % q->cap];
+        free(q->proc);
+        q->proc = proc;
+        q->head = 0;
+        q->cap = cap;
+        return 0;
+}
+
 void enqueue(struct queue_t * q, struct pcb_t * proc) {
-        /* TODO: put a new process to queue [q] */
-        if (proc == NULL || q == NULL || q->size == MAX_QUEUE_SIZE) return;
-        q->proc[q->size] = proc;
+        /* put a new process to the tail of queue [q] */
+        if (proc == NULL || q == NULL) return;
+        if (q->size == q->cap && grow(q) != 0) {
+                printf("\nQueue is out of memory, process %d is lost\n",
+                        proc->pid);
+                return;
+        }
+        q->proc[(q->head + q->size) % q->cap] = proc;
         q->size++;
 }
 
 struct pcb_t * dequeue(struct queue_t * q) {
-        /* TODO: return a pcb whose prioprity is the highest
-         * in the queue [q] and remember to remove it from q
-         * */
-
         /*
-                Input: a ready queue 
+                Input: a ready queue
                 Q's priority is already filtered in Sched.c by proc->prio
-                Output:  a pcb whose prioprity is the highest priority
+                Output: the oldest pcb of the queue, processes of the same
+                        level are served in FIFO order
         */
         if (empty(q))
         {
                 printf("\nQueue is empty\n");
                 return NULL;
         }
-        /*
-                max_prio_index and max_prio is assumed to be the highest prio queue to be exported
-        */
-        int max_prio = 0;
-        for (int i = max_prio; i < q->size; i++) if(q->proc[i]->priority < q->proc[max_prio]->priority) max_prio = i;
-        struct pcb_t *proc = q->proc[max_prio];
-        for (int i = max_prio; i < q->size - 1; i++)
-                q->proc[i] = q->proc[i + 1];
+        struct pcb_t *proc = q->proc[q->head];
+        q->head = (q->head + 1) % q->cap;
         q->size--;
         return proc;
 }
 
+int lf_queue_init(struct lf_queue_t * q, unsigned long cap) {
+        unsigned long i, n = 2;
+        while (n < cap) n <<= 1;
+        q->cells = malloc(sizeof(struct lf_cell_t) * n);
+        if (q->cells == NULL) return -1;
+        for (i = 0; i < n; i++) {
+                q->cells[i].seq = i;
+                q->cells[i].proc = NULL;
+        }
+        q->mask = n - 1;
+        q->head = 0;
+        q->tail = 0;
+        return 0;
+}
+
+void lf_queue_free(struct lf_queue_t * q) {
+        free(q->cells);
+        q->cells = NULL;
+}
+
+/*
+ * A cell is free for the producer of position [pos] when its sequence
+ * equals pos, and holds data for the consumer of [pos] when it equals
+ * pos + 1. Producers and consumers claim positions with a CAS on
+ * tail/head and publish the cell with a release store of seq.
+ */
+int lf_enqueue(struct lf_queue_t * q, struct pcb_t * proc) {
+        struct lf_cell_t * cell;
+        unsigned long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+                long dif = (long)seq - (long)pos;
+                if (dif == 0) {
+                        if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1,
+                                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                                break;
+                } else if (dif < 0) {
+                        return -1; /* Full */
+                } else {
+                        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+                }
+        }
+        cell->proc = proc;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        return 0;
+}
+
+struct pcb_t * lf_dequeue(struct lf_queue_t * q) {
+        struct lf_cell_t * cell;
+        struct pcb_t * proc;
+        unsigned long pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+        for (;;) {
+                cell = &q->cells[pos & q->mask];
+                unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+                long dif = (long)seq - (long)(pos + 1);
+                if (dif == 0) {
+                        if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+                                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                                break;
+                } else if (dif < 0) {
+                        return NULL; /* Empty */
+                } else {
+                        pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+                }
+        }
+        proc = cell->proc;
+        __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+        return proc;
+}
+
+int lf_empty(struct lf_queue_t * q) {
+        return __atomic_load_n(&q->head, __ATOMIC_SEQ_CST) ==
+                __atomic_load_n(&q->tail, __ATOMIC_SEQ_CST);
+}
+
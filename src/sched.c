@@ -1,139 +1,448 @@
 #include "queue.h"
-#include "sched.h"
+#include "mlq_sched.h"
+#include "bitops.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 static struct queue_t ready_queue;
 static struct queue_t run_queue;
 static pthread_mutex_t queue_lock;
 
 #ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
-int slot[MAX_PRIO];
+/*
+ * MLQ run queue. In the global mode a single run queue is shared by
+ * every CPU. In the per-CPU mode each CPU owns one run queue:
+ * a preempted process goes back to the queue of the CPU it ran on and
+ * an idle CPU steals from the busiest sibling.
+ */
+struct mlq_rq {
+	pthread_mutex_t lock;
+#ifdef LOCKFREE_SCHED
+	/* Level queues are allocated on first use, slot budgets are packed
+	 * as (epoch << 32 | slot) so they can be updated with one CAS */
+	struct lf_queue_t *lfq[MAX_PRIO];
+	unsigned long long slotv[MAX_PRIO];
+#else
+	struct queue_t queue[MAX_PRIO];
+	int slot[MAX_PRIO];
+#endif
+
+	/* Priority bitmaps:
+	 *   ready_map : levels holding at least one process
+	 *   slot_map  : levels with slot budget left in the current round
+	 * A level is eligible for dispatch when it is set in both maps.
+	 */
+	unsigned long long ready_map[BITMAP_WORDS(MAX_PRIO)];
+	unsigned long long slot_map[BITMAP_WORDS(MAX_PRIO)];
+
+	/* slot[i] is only meaningful while slot_epoch[i] == epoch, any
+	 * older value stands for a full budget of (MAX_PRIO - i) slots */
+	unsigned int slot_epoch[MAX_PRIO];
+	unsigned int epoch;
+
+	/* Number of queued processes, read without the lock by stealers */
+	int nr_ready;
+};
+
+static struct mlq_rq *mlq_rqs;
+static int nr_rqs;
+#ifdef LOCKFREE_SCHED
+/* Cells of the level queues of each priority, in every run queue: the
+ * processes of that priority, a process sits in one queue at a time */
+static int lfq_cap[MAX_PRIO];
+#endif
 #endif
 
 int queue_empty(void)
 {
 #ifdef MLQ_SCHED
-	unsigned long prio;
-	for (prio = 0; prio < MAX_PRIO; prio++)
-		if (!empty(&mlq_ready_queue[prio]))
+	int i;
+
+	for (i = 0; i < nr_rqs; i++)
+		if (__atomic_load_n(&mlq_rqs[i].nr_ready, __ATOMIC_RELAXED) > 0)
 			return -1;
 #endif
 	return (empty(&ready_queue) && empty(&run_queue));
 }
 
-void init_scheduler(void)
+void init_scheduler(int num_cpus, int max_procs, int percpu)
 {
 #ifdef MLQ_SCHED
-	int i;
+	int i, j;
 
-	for (i = 0; i < MAX_PRIO; i++)
+	nr_rqs = percpu && num_cpus > 0 ? num_cpus : 1;
+	mlq_rqs = malloc(sizeof(struct mlq_rq) * nr_rqs);
+	for (j = 0; j < nr_rqs; j++)
 	{
-		mlq_ready_queue[i].size = 0;
-		slot[i] = MAX_PRIO - i;
+		struct mlq_rq *rq = &mlq_rqs[j];
+
+		for (i = 0; i < MAX_PRIO; i++)
+		{
+#ifdef LOCKFREE_SCHED
+			rq->lfq[i] = NULL;
+			rq->slotv[i] = MAX_PRIO - i;
+#else
+			init_queue(&rq->queue[i]);
+			rq->slot[i] = MAX_PRIO - i;
+#endif
+			rq->slot_epoch[i] = 0;
+		}
+		rq->epoch = 0;
+		memset(rq->ready_map, 0, sizeof(rq->ready_map));
+		bitmap_fill(rq->slot_map, MAX_PRIO);
+		rq->nr_ready = 0;
+		pthread_mutex_init(&rq->lock, NULL);
 	}
+#ifdef LOCKFREE_SCHED
+	for (i = 0; i < MAX_PRIO; i++)
+		lfq_cap[i] = max_procs > 0 ? max_procs : 1;
+#endif
 #endif
-	ready_queue.size = 0;
-	run_queue.size = 0;
+	init_queue(&ready_queue);
+	init_queue(&run_queue);
 	pthread_mutex_init(&queue_lock, NULL);
 }
 
+void finish_scheduler(void)
+{
+#ifdef MLQ_SCHED
+	int i, j;
+
+	for (j = 0; j < nr_rqs; j++)
+	{
+		for (i = 0; i < MAX_PRIO; i++)
+		{
+#ifdef LOCKFREE_SCHED
+			if (mlq_rqs[j].lfq[i] != NULL)
+			{
+				lf_queue_free(mlq_rqs[j].lfq[i]);
+				free(mlq_rqs[j].lfq[i]);
+			}
+#else
+			free_queue(&mlq_rqs[j].queue[i]);
+#endif
+		}
+		pthread_mutex_destroy(&mlq_rqs[j].lock);
+	}
+	free(mlq_rqs);
+	mlq_rqs = NULL;
+	nr_rqs = 0;
+#endif
+	free_queue(&ready_queue);
+	free_queue(&run_queue);
+	pthread_mutex_destroy(&queue_lock);
+}
+
+void sched_bound_prio(int prio, int nr)
+{
+#if defined(MLQ_SCHED) && defined(LOCKFREE_SCHED)
+	if (prio >= 0 && prio < MAX_PRIO && nr > 0)
+		lfq_cap[prio] = nr;
+#endif
+}
+
 #ifdef MLQ_SCHED
+#ifdef LOCKFREE_SCHED
 /*
- *  Stateful design for routine calling
- *  based on the priority and our MLQ policy
- *  We implement stateful here using transition technique
- *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
+ * Lock-free MLQ: level queues are lf_queue_t, the priority bitmaps
+ * are updated with atomic or/and and slot budgets with a CAS on the
+ * packed (epoch, slot) word. Producers publish the process before
+ * setting its ready bit; a consumer only clears a ready bit after it
+ * found the level empty and re-checks the level afterwards, so a
+ * concurrent push can never be left behind a clear bit.
  */
-void set_slot()
+#define SLOTV(epoch, slot)	(((unsigned long long)(epoch) << 32) | (unsigned int)(slot))
+#define SLOTV_EPOCH(v)		((unsigned int)((v) >> 32))
+#define SLOTV_SLOT(v)		((int)(unsigned int)(v))
+
+static void map_set(unsigned long long *map, int nr)
 {
-	for (int i = 0; i < MAX_PRIO; i++)
-		slot[i] = MAX_PRIO - i;
+	__atomic_fetch_or(&map[nr / BITMAP_WORD_BITS],
+			BIT_ULL(nr % BITMAP_WORD_BITS), __ATOMIC_SEQ_CST);
 }
-int check_new_process_come(int i)
+
+static void map_clr(unsigned long long *map, int nr)
+{
+	__atomic_fetch_and(&map[nr / BITMAP_WORD_BITS],
+			~BIT_ULL(nr % BITMAP_WORD_BITS), __ATOMIC_SEQ_CST);
+}
+
+static void map_load(unsigned long long *dst, unsigned long long *map)
+{
+	int i;
+
+	for (i = 0; i < BITMAP_WORDS(MAX_PRIO); i++)
+		dst[i] = __atomic_load_n(&map[i], __ATOMIC_SEQ_CST);
+}
+
+/* Start a new round unless another CPU already did it for [epoch] */
+static void set_slot(struct mlq_rq *rq, unsigned int epoch)
 {
-	for (int j = 0; j < i; j++)
+	unsigned long long full[BITMAP_WORDS(MAX_PRIO)];
+	int i;
+
+	if (!__atomic_compare_exchange_n(&rq->epoch, &epoch, epoch + 1, 0,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		return;
+	bitmap_fill(full, MAX_PRIO);
+	for (i = 0; i < BITMAP_WORDS(MAX_PRIO); i++)
+		__atomic_store_n(&rq->slot_map[i], full[i], __ATOMIC_SEQ_CST);
+}
+
+/* Charge one slot of level [prio], a stale epoch means a full budget */
+static void take_slot(struct mlq_rq *rq, int prio)
+{
+	unsigned long long v, nv;
+	unsigned int epoch;
+	int left;
+
+	v = __atomic_load_n(&rq->slotv[prio], __ATOMIC_RELAXED);
+	do {
+		epoch = __atomic_load_n(&rq->epoch, __ATOMIC_SEQ_CST);
+		left = SLOTV_EPOCH(v) == epoch ? SLOTV_SLOT(v) : MAX_PRIO - prio;
+		nv = SLOTV(epoch, left - 1);
+	} while (!__atomic_compare_exchange_n(&rq->slotv[prio], &v, nv, 1,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	if (left - 1 <= 0)
+		map_clr(rq->slot_map, prio);
+}
+
+/* Level queue [prio] of [rq], NULL if it could not be allocated */
+static struct lf_queue_t *get_lfq(struct mlq_rq *rq, int prio)
+{
+	struct lf_queue_t *q = __atomic_load_n(&rq->lfq[prio], __ATOMIC_ACQUIRE);
+	struct lf_queue_t *expected = NULL;
+
+	if (q != NULL)
+		return q;
+	q = malloc(sizeof(struct lf_queue_t));
+	if (q == NULL)
+		return NULL;
+	if (lf_queue_init(q, lfq_cap[prio]) != 0)
 	{
-		if (empty(&mlq_ready_queue[j]) || slot[j] <= 0)
-			continue;
-		return j - 1;
+		free(q);
+		return NULL;
+	}
+	if (!__atomic_compare_exchange_n(&rq->lfq[prio], &expected, q, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		/* Lost the race, use the queue installed by someone else */
+		lf_queue_free(q);
+		free(q);
+		q = expected;
 	}
-	return -2;
+	return q;
 }
-struct pcb_t *get_mlq_proc(void)
+
+static struct pcb_t *mlq_pick(struct mlq_rq *rq)
 {
-	struct pcb_t *proc = NULL;
-	/*TODO: get a process from PRIORITY [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 */
-	int flag = 0;
-	int index = 0;
-	for (int i = 0; i < MAX_PRIO; ++i)
+	unsigned long long ready[BITMAP_WORDS(MAX_PRIO)];
+	unsigned long long budget[BITMAP_WORDS(MAX_PRIO)];
+	struct lf_queue_t *q;
+	struct pcb_t *proc;
+	unsigned int epoch;
+	int prio;
+
+	for (;;)
 	{
-		pthread_mutex_lock(&queue_lock);
-		index = check_new_process_come(i);
-		if (index != -2)
+		epoch = __atomic_load_n(&rq->epoch, __ATOMIC_SEQ_CST);
+		map_load(ready, rq->ready_map);
+		map_load(budget, rq->slot_map);
+		prio = bitmap_find_first_and(ready, budget, MAX_PRIO);
+		if (prio < 0)
 		{
-			i = index;
-			pthread_mutex_unlock(&queue_lock);
+			if (bitmap_find_first(ready, MAX_PRIO) < 0)
+				return NULL;
+			/* Every ready level used up its slots */
+			set_slot(rq, epoch);
 			continue;
 		}
-		if (empty(&mlq_ready_queue[i]))
+
+		/* A level without a queue never had a process pushed */
+		q = get_lfq(rq, prio);
+		proc = q != NULL ? lf_dequeue(q) : NULL;
+		if (proc != NULL)
 		{
-			if (flag == 1 && i == MAX_PRIO - 1)
-			{
-				flag = 0;
-				set_slot();
-				i = -1;
-			}
-			pthread_mutex_unlock(&queue_lock);
-			continue;
+			take_slot(rq, prio);
+			__atomic_fetch_sub(&rq->nr_ready, 1, __ATOMIC_RELAXED);
+			return proc;
 		}
-		if (slot[i] <= 0)
-		{
-			flag = 1;
-			if (i == MAX_PRIO - 1)
-			{
-				flag = 0;
-				set_slot();
-				i = -1;
-			}
-			pthread_mutex_unlock(&queue_lock);
+
+		/* The level went empty under us, retire its bit unless a
+		 * producer refilled it meanwhile */
+		map_clr(rq->ready_map, prio);
+		if (q != NULL && !lf_empty(q))
+			map_set(rq->ready_map, prio);
+	}
+}
+
+static void mlq_push(struct mlq_rq *rq, struct pcb_t *proc)
+{
+	struct lf_queue_t *q = get_lfq(rq, proc->prio);
+
+	if (q == NULL)
+	{
+		printf("Cannot allocate ready queue of priority %u\n", proc->prio);
+		exit(1);
+	}
+	while (lf_enqueue(q, proc) != 0)
+		; /* Cannot happen, see lfq_cap */
+	__atomic_fetch_add(&rq->nr_ready, 1, __ATOMIC_RELAXED);
+	map_set(rq->ready_map, proc->prio);
+}
+#else
+/*
+ *  Stateful design for routine calling
+ *  based on the priority and our MLQ policy
+ *  We implement stateful here using transition technique
+ *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
+ *
+ *  A new round does not rewrite slot[]: bumping the epoch invalidates
+ *  every level at once and get_slot() refills a level lazily on use.
+ */
+static void set_slot(struct mlq_rq *rq)
+{
+	rq->epoch++;
+	bitmap_fill(rq->slot_map, MAX_PRIO);
+}
+
+static int *get_slot(struct mlq_rq *rq, int prio)
+{
+	if (rq->slot_epoch[prio] != rq->epoch)
+	{
+		rq->slot_epoch[prio] = rq->epoch;
+		rq->slot[prio] = MAX_PRIO - prio;
+	}
+	return &rq->slot[prio];
+}
+
+/* Pick the next process of [rq] by the MLQ policy */
+static struct pcb_t *__mlq_pick(struct mlq_rq *rq)
+{
+	struct pcb_t *proc;
+	int prio;
+
+	/* Highest priority level that is non-empty and still has budget */
+	prio = bitmap_find_first_and(rq->ready_map, rq->slot_map, MAX_PRIO);
+	if (prio < 0)
+	{
+		/* Every ready level used up its slots, start a new round */
+		prio = bitmap_find_first(rq->ready_map, MAX_PRIO);
+		if (prio < 0)
+			return NULL;
+		set_slot(rq);
+	}
+
+	proc = dequeue(&rq->queue[prio]);
+	if (empty(&rq->queue[prio]))
+		BITMAP_CLR(rq->ready_map, prio);
+	if (--(*get_slot(rq, prio)) <= 0)
+		BITMAP_CLR(rq->slot_map, prio);
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready - 1, __ATOMIC_RELAXED);
+	return proc;
+}
+
+static struct pcb_t *mlq_pick(struct mlq_rq *rq)
+{
+	struct pcb_t *proc;
+
+	pthread_mutex_lock(&rq->lock);
+	proc = __mlq_pick(rq);
+	pthread_mutex_unlock(&rq->lock);
+	return proc;
+}
+
+static void mlq_push(struct mlq_rq *rq, struct pcb_t *proc)
+{
+	pthread_mutex_lock(&rq->lock);
+	enqueue(&rq->queue[proc->prio], proc);
+	BITMAP_SET(rq->ready_map, proc->prio);
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&rq->lock);
+}
+
+#endif /* LOCKFREE_SCHED */
+
+static struct mlq_rq *cpu_rq(int cpu)
+{
+	return &mlq_rqs[nr_rqs > 1 ? cpu % nr_rqs : 0];
+}
+
+/* Steal a process for [cpu] from the sibling with the most ready ones */
+static struct pcb_t *mlq_steal(int cpu)
+{
+	struct mlq_rq *busiest = NULL;
+	int i, nr, max_nr = 0;
+
+	for (i = 0; i < nr_rqs; i++)
+	{
+		if (i == cpu % nr_rqs)
 			continue;
+		nr = __atomic_load_n(&mlq_rqs[i].nr_ready, __ATOMIC_RELAXED);
+		if (nr > max_nr)
+		{
+			max_nr = nr;
+			busiest = &mlq_rqs[i];
 		}
-		proc = dequeue(&mlq_ready_queue[i]);
-		slot[i]--;
-		pthread_mutex_unlock(&queue_lock);
-		break;
 	}
+	if (busiest == NULL)
+		return NULL;
+
+	return mlq_pick(busiest);
+}
 
+struct pcb_t *get_mlq_proc(int cpu)
+{
+	struct mlq_rq *rq = cpu_rq(cpu);
+	struct pcb_t *proc = NULL;
+
+	if (__atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED) > 0 || nr_rqs == 1)
+		proc = mlq_pick(rq);
+	if (proc == NULL && nr_rqs > 1)
+		proc = mlq_steal(cpu);
 	return proc;
 }
 
-void put_mlq_proc(struct pcb_t *proc)
+void put_mlq_proc(int cpu, struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	/* Keep the process on the CPU it ran on for cache affinity */
+	mlq_push(cpu_rq(cpu), proc);
 }
 
 void add_mlq_proc(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	static unsigned int next_rq;
+	struct mlq_rq *rq = &mlq_rqs[0];
+	unsigned int start;
+	int i, j, nr, min_nr = -1;
+
+	/* New processes go to the least loaded run queue, ties are
+	 * broken round robin so that idle CPUs get work in turn. The
+	 * loader and preempting CPUs may add concurrently */
+	start = __atomic_fetch_add(&next_rq, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nr_rqs; i++)
+	{
+		j = (start + i) % nr_rqs;
+		nr = __atomic_load_n(&mlq_rqs[j].nr_ready, __ATOMIC_RELAXED);
+		if (min_nr < 0 || nr < min_nr)
+		{
+			min_nr = nr;
+			rq = &mlq_rqs[j];
+		}
+	}
+	mlq_push(rq, proc);
 }
 
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(int cpu)
 {
-	return get_mlq_proc();
+	return get_mlq_proc(cpu);
 }
 
-void put_proc(struct pcb_t *proc)
+void put_proc(int cpu, struct pcb_t *proc)
 {
-	return put_mlq_proc(proc);
+	return put_mlq_proc(cpu, proc);
 }
 
 void add_proc(struct pcb_t *proc)
@@ -141,7 +450,7 @@ void add_proc(struct pcb_t *proc)
 	return add_mlq_proc(proc);
 }
 #else
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(int cpu)
 {
 	struct pcb_t *proc = NULL;
 	/*TODO: get a process from [ready_queue].
@@ -159,7 +468,7 @@ struct pcb_t *get_proc(void)
 	return proc;
 }
 
-void put_proc(struct pcb_t *proc)
+void put_proc(int cpu, struct pcb_t *proc)
 {
 	pthread_mutex_lock(&queue_lock);
 	enqueue(&run_queue, proc);
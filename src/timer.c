@@ -2,8 +2,16 @@
 #include "timer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#if defined(TIMER_BARRIER) && defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
 
+#ifndef TIMER_BARRIER
 static pthread_t _timer;
+#endif
 
 struct timer_id_container_t {
 	struct timer_id_t id;
@@ -17,12 +25,194 @@ static uint64_t _time;
 static int timer_started = 0;
 static int timer_stop = 0;
 
+/*
+ * fast_forward - skip the slots [_time, wake) in which every device
+ * is known to idle. [mode] selects how they are reported:
+ *   0 : do not skip at all
+ *   1 : one "Time slot" line per skipped slot, same output as ticking
+ *   2 : one summary line for the whole skipped range
+ *   3 : nothing
+ * The tick engines use TIMER_FASTFWD as mode, 0 when it is not set.
+ */
+#ifdef TIMER_FASTFWD
+#define FASTFWD_MODE TIMER_FASTFWD
+#else
+#define FASTFWD_MODE 0
+#endif
 
+static void fast_forward(uint64_t wake, int mode) {
+	if (mode == 0 || wake == TIMER_NEVER || wake <= _time) {
+		return;
+	}
+	if (mode == 1) {
+		while (_time < wake) {
+			printf("Time slot %3lu\n", _time);
+			_time++;
+		}
+	}else if (mode == 2) {
+		printf("Time slot %3lu - %3lu skipped, all devices idle\n",
+			_time, wake - 1);
+	}
+	_time = wake;
+}
+
+#ifdef TIMER_BARRIER
+/*
+ * Barrier tick engine. Instead of a timer thread handshaking with
+ * every device, all attached devices meet at a sense-reversing barrier
+ * at the end of each slot. The last one to arrive advances the clock
+ * and flips the global sense, releasing the others: one slot costs a
+ * single atomic decrement per device plus one wake-up.
+ */
+
+/* Spins before a waiter falls back to sleeping on the futex */
+#define BARRIER_SPIN 1000
+
+static int nr_active;	/* Devices attached and not detached yet */
+static int bar_count;	/* Arrivals still missing in the current slot */
+static int bar_sense;	/* Flipped when a slot is over */
+static int bar_busy;	/* Arrivals in the current slot that were not idle */
+static uint64_t bar_wake = TIMER_NEVER;	/* Earliest wake-up of idle arrivals */
+static uint32_t bar_gen;	/* Low bits of _time, set once a slot is open */
+
+static void barrier_wait(int sense) {
+	int spin;
+	for (spin = 0; spin < BARRIER_SPIN; spin++) {
+		if (__atomic_load_n(&bar_sense, __ATOMIC_ACQUIRE) == sense)
+			return;
+	}
+	while (__atomic_load_n(&bar_sense, __ATOMIC_ACQUIRE) != sense) {
+#ifdef __linux__
+		syscall(SYS_futex, &bar_sense, FUTEX_WAIT_PRIVATE,
+			!sense, NULL, NULL, 0);
+#endif
+	}
+}
+
+/* Wait for slot [until] to open, for a device busy until then */
+static void barrier_sleep(uint64_t until) {
+	uint32_t gen;
+	while ((int32_t)((gen = __atomic_load_n(&bar_gen, __ATOMIC_ACQUIRE)) -
+			(uint32_t)until) < 0) {
+#ifdef __linux__
+		syscall(SYS_futex, &bar_gen, FUTEX_WAIT_PRIVATE,
+			gen, NULL, NULL, 0);
+#endif
+	}
+}
+
+/* Count the devices busy through slot _time, they do not arrive in it.
+ * [waking] is set if one is back in it */
+static int barrier_sleepers(int * waking) {
+	struct timer_id_container_t * temp;
+	int sleepers = 0;
+
+	*waking = 0;
+	for (temp = dev_list; temp != NULL; temp = temp->next) {
+		if (temp->id.fsh) {
+			continue;
+		}
+		if (temp->id.busy_until > _time) {
+			sleepers++;
+		} else if (temp->id.busy_until == _time) {
+			*waking = 1;
+		}
+	}
+	return sleepers;
+}
+
+/* Run by the last device to arrive: end the slot, release the others */
+static void barrier_complete(int sense) {
+	int active = __atomic_load_n(&nr_active, __ATOMIC_ACQUIRE);
+	int sleepers, waking;
+
+	_time++;
+	if (__atomic_load_n(&bar_busy, __ATOMIC_RELAXED) == 0) {
+		fast_forward(__atomic_load_n(&bar_wake, __ATOMIC_RELAXED),
+			FASTFWD_MODE);
+	}
+	/* Nobody would arrive in a slot every device is busy through */
+	while ((sleepers = barrier_sleepers(&waking)) == active && active > 0) {
+		printf("Time slot %3lu\n", current_time());
+		_time++;
+	}
+	__atomic_store_n(&bar_busy, sleepers, __ATOMIC_RELAXED);
+	__atomic_store_n(&bar_wake, TIMER_NEVER, __ATOMIC_RELAXED);
+	__atomic_store_n(&bar_count, active - sleepers, __ATOMIC_RELAXED);
+	if (active > 0) {
+		printf("Time slot %3lu\n", current_time());
+	}
+	__atomic_store_n(&bar_sense, sense, __ATOMIC_RELEASE);
+	__atomic_store_n(&bar_gen, (uint32_t)_time, __ATOMIC_RELEASE);
+#ifdef __linux__
+	syscall(SYS_futex, &bar_sense, FUTEX_WAKE_PRIVATE, INT_MAX,
+		NULL, NULL, 0);
+	if (waking) {
+		syscall(SYS_futex, &bar_gen, FUTEX_WAKE_PRIVATE, INT_MAX,
+			NULL, NULL, 0);
+	}
+#endif
+}
+
+/* Returns 1 if the caller was the last one to arrive in this slot */
+static int barrier_arrive(struct timer_id_t * timer_id) {
+	uint64_t wake = timer_id->idle_until;
+
+	if (wake == 0) {
+		__atomic_add_fetch(&bar_busy, 1, __ATOMIC_RELAXED);
+	} else {
+		uint64_t cur = __atomic_load_n(&bar_wake, __ATOMIC_RELAXED);
+		while (wake < cur && !__atomic_compare_exchange_n(&bar_wake,
+				&cur, wake, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	timer_id->sense = !timer_id->sense;
+	if (__atomic_sub_fetch(&bar_count, 1, __ATOMIC_ACQ_REL) == 0) {
+		barrier_complete(timer_id->sense);
+		return 1;
+	}
+	return 0;
+}
+
+static void __next_slot(struct timer_id_t * timer_id, uint64_t wake) {
+	timer_id->idle_until = wake;
+	if (!barrier_arrive(timer_id)) {
+		barrier_wait(timer_id->sense);
+	}
+}
+
+static void __next_slot_busy(struct timer_id_t * timer_id) {
+	/* Arrive once, the slots up to busy_until are ended without it */
+	timer_id->idle_until = 0;
+	barrier_arrive(timer_id);
+	barrier_sleep(timer_id->busy_until);
+	/* Flipped for the slot before busy_until, the next flip needs us */
+	timer_id->sense = __atomic_load_n(&bar_sense, __ATOMIC_ACQUIRE);
+}
+
+void start_timer() {
+	timer_started = 1;
+	bar_count = nr_active;
+	bar_sense = 0;
+	bar_gen = 0;
+	printf("Time slot %3lu\n", current_time());
+}
+
+void detach_event(struct timer_id_t * event) {
+	/* Leave the barrier: stop being waited for from the next slot on
+	 * and count as arrived in the current one */
+	event->fsh = 1;
+	event->idle_until = TIMER_NEVER;
+	__atomic_sub_fetch(&nr_active, 1, __ATOMIC_ACQ_REL);
+	barrier_arrive(event);
+}
+#else
 static void * timer_routine(void * args) {
 	while (!timer_stop) {
 		printf("Time slot %3lu\n", current_time());
 		int fsh = 0;
 		int event = 0;
+		int busy = 0;
+		uint64_t wake = TIMER_NEVER;
 		/* Wait for all devices have done the job in current
 		 * time slot */
 		struct timer_id_container_t * temp;
@@ -36,6 +226,10 @@ static void * timer_routine(void * args) {
 			}
 			if (temp->id.fsh) {
 				fsh++;
+			} else if (temp->id.idle_until == 0) {
+				busy++;
+			} else if (temp->id.idle_until < wake) {
+				wake = temp->id.idle_until;
 			}
 			event++;
 			pthread_mutex_unlock(&temp->id.event_lock);
@@ -43,9 +237,16 @@ static void * timer_routine(void * args) {
 
 		/* Increase the time slot */
 		_time++;
-		
-		/* Let devices continue their job */
+		if (busy == 0) {
+			fast_forward(wake, FASTFWD_MODE);
+		}
+
+		/* Let devices continue their job, a device still busy
+		 * stays done (see next_slot_busy) */
 		for (temp = dev_list; temp != NULL; temp = temp->next) {
+			if (temp->id.busy_until > _time) {
+				continue;
+			}
 			pthread_mutex_lock(&temp->id.timer_lock);
 			temp->id.done = 0;
 			pthread_cond_signal(&temp->id.timer_cond);
@@ -58,9 +259,10 @@ static void * timer_routine(void * args) {
 	pthread_exit(args);
 }
 
-void next_slot(struct timer_id_t * timer_id) {
+static void __next_slot(struct timer_id_t * timer_id, uint64_t wake) {
 	/* Tell to timer that we have done our job in current slot */
 	pthread_mutex_lock(&timer_id->event_lock);
+	timer_id->idle_until = wake;
 	timer_id->done = 1;
 	pthread_cond_signal(&timer_id->event_cond);
 	pthread_mutex_unlock(&timer_id->event_lock);
@@ -76,8 +278,9 @@ void next_slot(struct timer_id_t * timer_id) {
 	pthread_mutex_unlock(&timer_id->timer_lock);
 }
 
-uint64_t current_time() {
-	return _time;
+static void __next_slot_busy(struct timer_id_t * timer_id) {
+	/* Stays done until the timer reaches busy_until */
+	__next_slot(timer_id, 0);
 }
 
 void start_timer() {
@@ -91,6 +294,41 @@ void detach_event(struct timer_id_t * event) {
 	pthread_cond_signal(&event->event_cond);
 	pthread_mutex_unlock(&event->event_lock);
 }
+#endif /* TIMER_BARRIER */
+
+void next_slot(struct timer_id_t * timer_id) {
+	__next_slot(timer_id, 0);
+}
+
+void next_slot_idle(struct timer_id_t * timer_id, uint64_t wake) {
+	__next_slot(timer_id, wake);
+}
+
+void next_slot_busy(struct timer_id_t * timer_id, uint64_t slots) {
+	if (slots <= 1) {
+		__next_slot(timer_id, 0);
+		return;
+	}
+	/* The clock cannot move before this device is done with the slot */
+	timer_id->busy_until = current_time() + slots;
+	__next_slot_busy(timer_id);
+}
+
+uint64_t current_time() {
+	return _time;
+}
+
+void sim_start() {
+	_time = 0;
+	printf("Time slot %3lu\n", current_time());
+}
+
+void sim_advance(uint64_t t) {
+	/* Nobody has anything to do before [t], always skip */
+	_time++;
+	fast_forward(t, FASTFWD_MODE ? FASTFWD_MODE : 1);
+	printf("Time slot %3lu\n", current_time());
+}
 
 struct timer_id_t * attach_event() {
 	if (timer_started) {
@@ -102,6 +340,12 @@ struct timer_id_t * attach_event() {
 			);
 		container->id.done = 0;
 		container->id.fsh = 0;
+		container->id.idle_until = 0;
+		container->id.busy_until = 0;
+#ifdef TIMER_BARRIER
+		container->id.sense = 0;
+		nr_active++;
+#endif
 		pthread_cond_init(&container->id.event_cond, NULL);
 		pthread_mutex_init(&container->id.event_lock, NULL);
 		pthread_cond_init(&container->id.timer_cond, NULL);
@@ -119,7 +363,9 @@ struct timer_id_t * attach_event() {
 
 void stop_timer() {
 	timer_stop = 1;
+#ifndef TIMER_BARRIER
 	pthread_join(_timer, NULL);
+#endif
 	while (dev_list != NULL) {
 		struct timer_id_container_t * temp = dev_list;
 		dev_list = dev_list->next;